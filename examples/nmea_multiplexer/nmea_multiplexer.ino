@@ -9,6 +9,9 @@
 // the data was received from
 static boolean send_port_no = false;
 
+// Signalled by the serial ports the NMEA data is received on
+static JOS::Event input_received;
+
 int checksum(JOS::String& s) {
   int i = 0;
   byte c;
@@ -33,19 +36,22 @@ JOS::String& append_checksum(JOS::String& s) {
   return s;
 }
 
+// Scratch memory for the temporaries of handling a sentence
+static JOS::Static_arena<32> scratch;
+
 boolean check_checksum(JOS::String& s) {
-  static JOS::String sum;
   if (s.len() < 2)
     return false;
+  JOS::Arena::Scope scope(scratch);
+  JOS::String sum(scratch);
   int cks = checksum(s);
-  sum.clear();
   sum.write(cks_fmt, cks);
   JOS::Slice slc(s, -2, 0);
   return sum == slc;
 }
 
-struct LedFlash: JOS::Task {
-  LedFlash(int led): Task(), led_(led) {}
+struct LedFlash: JOS::PeriodicTask {
+  LedFlash(int led): PeriodicTask(500000), led_(led) {} // Flash led at 1 Hz
   virtual boolean run();
 private:
   int led_;
@@ -53,14 +59,15 @@ private:
 };
 
 boolean LedFlash::run() {
-  rest(500000); // Delay 500ms: flash led at 1 Hz 
+  next_period();
   digitalWrite(led_, state_);  
   state_ = !state_;
   return false; // We're never done
 }
 
-struct Ping: JOS::Task {
+struct Ping: JOS::PeriodicTask {
   Ping(JOS::Output_stream* output): 
+      PeriodicTask(10000000), // Send ping every 10s
       output_(output), ping_("$PPING,MULTIPLEXER*"), port0_("0:") {
     append_checksum(ping_);
     ping_ << "\r\n";
@@ -73,7 +80,7 @@ private:
 };
 
 boolean Ping::run() {
-  rest(10000000); // Delay 100000ms: send ping every 10s
+  next_period();
   D_JOS("Ping!");
   ping_.rewind();
   if (send_port_no) {
@@ -100,16 +107,17 @@ private:
   JOS::Input_stream* input1_;
   JOS::Input_stream* input2_;
   JOS::Input_stream* input3_;
-  JOS::String sentence1_;
-  JOS::String sentence2_;
-  JOS::String sentence3_;
+  // NMEA sentences are at most 82 characters
+  JOS::Small_string<82> sentence1_;
+  JOS::Small_string<82> sentence2_;
+  JOS::Small_string<82> sentence3_;
 };
 
 boolean Multiplexer::run() {
-  rest(20000); // Delay 20ms: run service at 50 Hz
   handle_input(1, *input1_, sentence1_);
   handle_input(2, *input2_, sentence2_);
   handle_input(3, *input3_, sentence3_);
+  wait(input_received); // Run again when more data comes in
   return false; // We're never done!
 }
 
@@ -143,9 +151,11 @@ void Multiplexer::handle_input(int port, JOS::Input_stream& input, JOS::String&
 
 struct CommandHandler: public JOS::Task {
   virtual boolean run();
-  CommandHandler(JOS::Input_stream* input): input_(input) {}
+  CommandHandler(JOS::Input_stream* input, JOS::Output_stream* output): 
+      input_(input), output_(output) {}
 private:
   JOS::Input_stream* input_;
+  JOS::Output_stream* output_;
 };
 
 boolean CommandHandler::run() 
@@ -166,6 +176,12 @@ boolean CommandHandler::run()
           D_JOS("Disabling port output");
           send_port_no = false;
         }
+#if TASK_TRACE != 0
+        else if (command == "TRCE") {
+          D_JOS("Dumping task trace");
+          JOS::tasks.add(JOS::tasks.dump_trace(*output_));
+        }
+#endif
         else {
           D_JOS("Unrecognised command");
         }
@@ -188,6 +204,9 @@ void setup()
   JOS::Serial* serial2 = new JOS::Serial(4800, 1);
   JOS::Serial* serial3 = new JOS::Serial(4800, 2);
   JOS::Serial* serial4 = new JOS::Serial(4800, 3);
+  serial2->set_rx_event(&input_received);
+  serial3->set_rx_event(&input_received);
+  serial4->set_rx_event(&input_received);
   
   D_JOS("Constructing Multiplexer");
   Multiplexer* task = new Multiplexer(
@@ -212,7 +231,7 @@ void setup()
   JOS::tasks.add(ping);
   
   D_JOS("Constructing and adding Command Handler");
-  CommandHandler* command_handler = new CommandHandler(serial1);
+  CommandHandler* command_handler = new CommandHandler(serial1, serial1);
   JOS::tasks.add(command_handler);
 
   // Pull RS485 enabler lines down
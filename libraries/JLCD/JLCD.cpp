@@ -58,47 +58,32 @@ void LCDTask::write_data(const byte value)
 
 boolean Init::run() 
 {
-  if (_run_state < 4)
+  JOS_BEGIN
+    D_JOS("Start LCD init");
     // Send 4 bit init commands: commands RS -> Low
     digitalWrite(pin_rs, LOW);
-  switch (_run_state) {
-    case 0:
-      D_JOS("Start LCD init");
-      // General initialization
-      write_nibble(0x3);
-      rest(5000);
-      return false;
-    case 1:
-      write_nibble(0x3);
-      rest(100);
-      return false;
-    case 2:
-      write_nibble(0x3);
-      rest(5000);
-      return false;
-    case 3:
-      // Set to 4 bit mode
-      write_nibble(0x2);
-      rest(1000);
-      return false;
-    case 4:
-      // From here we can send bytes in 4 bit mode
-      write_command(0x28); // 2 lines, 5x8 font
-      return false;
-    case 5:
-      write_command(0x0C); // display on, cursor off, no blink
-      return false;
-    case 6:
-      write_command(cmd_clear);
-      rest(2000);
-      return false;
-    case 7:
-      write_command(0x6); // entry mode: autoinc, no shift
-      return false;
-  }
-  D_JOS("Done LCD init");
+    // General initialization
+    write_nibble(0x3);
+    JOS_AWAIT_DELAY(5000);
+    write_nibble(0x3);
+    JOS_AWAIT_DELAY(100);
+    write_nibble(0x3);
+    JOS_AWAIT_DELAY(5000);
+    // Set to 4 bit mode
+    write_nibble(0x2);
+    JOS_AWAIT_DELAY(1000);
+    // From here we can send bytes in 4 bit mode
+    write_command(0x28); // 2 lines, 5x8 font
+    JOS_YIELD();
+    write_command(0x0C); // display on, cursor off, no blink
+    JOS_YIELD();
+    write_command(cmd_clear);
+    JOS_AWAIT_DELAY(2000);
+    write_command(0x6); // entry mode: autoinc, no shift
+    JOS_YIELD();
+    D_JOS("Done LCD init");
   // We're done!
-  return true;
+  JOS_END
 }
 
 void Display::put_char()
@@ -109,52 +94,38 @@ void Display::put_char()
   if (addr != _addr) {
     set_address(addr);
   }
-  _run_state = run_state_put_char;
 }
 
 boolean Display::run() 
 {
-  switch(_run_state) {
-    case 0:
-      D_JOS("Start running LCD");
-      return false;
-
-    case run_state_clear:
-      write_command(cmd_clear);
-      rest(2000);
-      return false;
-
-    case run_state_home:
-      write_command(cmd_home);
-      rest(2000);
-      return false;
-
-    case run_state_put_char:
-      write_data(_data[_char_index]);
-      // The address is automatically incremented after write
-      ++_addr;
-      _actual[_char_index] = _data[_char_index];
-      return false;
-
-    case run_state_done:
-      return true;
-
-    default:
-      _run_state = run_state_default;
-      if (_data[_char_index] != _actual[_char_index]) {
+  JOS_BEGIN
+    D_JOS("Start running LCD");
+    // Display should keep running until the LCD is destroyed
+    while (!_done) {
+      JOS_YIELD();
+      if (_command != 0) {
+        // Clear and home take a while
+        write_command(_command);
+        _command = 0;
+        rest(2000);
+      }
+      else if (_data[_char_index] != _actual[_char_index]) {
         D_JOS("Put char");
         put_char();
-        // Compensate for automatic state increment
-        --_run_state;
-        // Only one character at a time, so return now
-        return false;
+        // Only one command at a time
+        JOS_YIELD();
+        write_data(_data[_char_index]);
+        // The address is automatically incremented after write
+        ++_addr;
+        _actual[_char_index] = _data[_char_index];
       }
-      ++_char_index;
-      if (_char_index >= char_count)
-        _char_index = 0;
-      // Display should always remain running so always return false
-      return false;
-  }
+      else {
+        ++_char_index;
+        if (_char_index >= char_count)
+          _char_index = 0;
+      }
+    }
+  JOS_END
 }
 
 LCD::LCD()
@@ -51,7 +51,7 @@ protected:
 
 
 struct Display: public LCDTask {
-  Display(): LCDTask(), _addr(0), _char_index(0) {
+  Display(): LCDTask(), _addr(0), _char_index(0), _command(0), _done(false) {
     for (int i = 0; i < char_count; ++i) {
       _data[i] = ' ';
       _actual[i] = ' ';
@@ -61,12 +61,11 @@ struct Display: public LCDTask {
 protected:
   virtual boolean run();
 private:
-  static const byte run_state_clear = 100;
-  static const byte run_state_home = 102;
-  static const byte run_state_put_char = 104;
-  static const byte run_state_done = 120;
   byte _addr;
   int _char_index;
+  // Command to send before updating any more characters
+  byte _command;
+  boolean _done;
   char _actual[char_count];
   char _data[char_count];
   void set_address(byte addr) {
@@ -75,13 +74,13 @@ private:
   }
   void put_char();
   void clear() {
-    _run_state = run_state_clear;
+    _command = cmd_clear;
   }
   void home() {
-    _run_state = run_state_home;
+    _command = cmd_home;
   }
   void done() {
-    _run_state = run_state_done;
+    _done = true;
   }
 };
 
@@ -26,6 +26,45 @@
 
 namespace JOS {
 
+int copy(Output_stream& os, Input_stream& is)
+{
+  int copied = 0;
+  while (true) {
+    int room = os.writeable();
+    if (room <= 0)
+      break;
+    const byte* span;
+    int size = is.peek_span(&span);
+    if (size > 0) {
+      if (size > room)
+        size = room;
+      if (!os.write(span, size))
+        break;
+      is.consume(size);
+    }
+    else {
+      byte* window;
+      size = os.reserve(&window);
+      if (size > 0) {
+        size = is.read(window, min(size, room));
+        os.commit(size);
+      }
+      else {
+        // Neither stream can do better than copying through a buffer
+        const int buf_size = 16;
+        byte buf[buf_size];
+        size = is.read(buf, min(room, buf_size));
+        if (size > 0)
+          os.write(buf, size);
+      }
+    }
+    if (size == 0)
+      break;
+    copied += size;
+  }
+  return copied;
+}
+
 int Input_stream::skip(int size) {
   const int buf_size = 16;
   byte dump[buf_size];
@@ -95,10 +134,13 @@ int Output_text::write_string(const char* str, boolean complete, char pad, uint8
       Output_stream::write(pad); 
       ++i;
     }
-    i = 0;
-    while (str[i] && Output_stream::write(str[i])) 
-      ++i;
-    return i;
+    int size = strlen(str);
+    int room = writeable();
+    if (size > room)
+      size = room;
+    if (size > 0 && !write((const byte*)str, size))
+      return 0;
+    return size;
   }
   return 0;
 }
@@ -228,43 +270,66 @@ boolean Input_text::read(double* value)
   return true;
 }
 
+byte* Memory_block::reallocate(int new_capacity)
+{
+  if (on_heap()) {
+    byte* new_buf = (byte*)realloc(_buf, new_capacity);
+    if (new_buf != 0)
+      count_memory(new_capacity - _capacity);
+    return new_buf;
+  }
+  byte* new_buf = 0;
+  if (on_arena()) {
+    new_buf = (byte*)_arena->reallocate(_buf, _capacity, new_capacity);
+  }
+  else if (_arena != 0) {
+    new_buf = (byte*)_arena->allocate(new_capacity);
+  }
+  if (new_buf == 0) {
+    // No arena or it's full: carry on on the heap
+    new_buf = (byte*)malloc(new_capacity);
+    if (new_buf == 0)
+      return 0;
+    count_memory(new_capacity);
+  }
+  if (_buf != 0 && new_buf != _buf) 
+    memcpy(new_buf, _buf, _capacity);
+  return new_buf;
+}
+
 // There is no garantee that the new size will be accepted!
 void Memory_block::resize(int new_size)
 {
-  if (new_size == _size)
-    return;
   if (new_size > max_size)
     new_size = max_size;
-  int new_cap = ((new_size >> block_bits) + 1) << block_bits;
-  if (new_cap != _capacity) {
+  if (new_size > _capacity) {
+    // Grow geometrically, so appending takes amortized constant time
+    int new_cap = _capacity < min_capacity ? min_capacity : _capacity;
+    while (new_cap < new_size) {
+      new_cap *= 2;
+    }
+    if (new_cap > max_size)
+      new_cap = max_size;
     D_JOS("Membloc Alloc: current, capacity, new capacity");
     D_JOS((int)_buf);
     D_JOS((int)_capacity);
     D_JOS((int)new_cap);
-    byte* new_buf = (byte*)realloc(_buf, new_cap);
+    byte* new_buf = reallocate(new_cap);
     D_JOS("Membloc Alloc'ed:");
     D_JOS((int)new_buf);
-
-    if (new_buf != 0) {
-      _buf = new_buf;
-      _size = new_size;
-      if (new_cap < _capacity) 
-        _capacity = new_cap;
-      else while (new_cap > _capacity)
-        _buf[_capacity++] = 0x00;
-    }
-#ifdef DEBUG
-    else {
+    if (new_buf == 0) {
       D_JOS("Out of memory");
+      return;
     }
-#endif
+    memset(new_buf + _capacity, 0, new_cap - _capacity);
+    _buf = new_buf;
+    _capacity = new_cap;
   }
-  else {
-    while (_size > new_size) {
-      _buf[--_size] = 0x00;
-    }
-    _size = new_size;
+  else if (new_size < _size) {
+    // Keep the capacity, as it's likely to be needed again
+    memset(_buf + new_size, 0, _size - new_size);
   }
+  _size = new_size;
 }
 
 
@@ -289,19 +354,14 @@ byte Array::get_item(const int item) const
 boolean String::write(const byte* data, int size)
 {
   D_JOS("String::write(const byte*, int)");
-  if (writeable() >= size) {
-    int length = len();
-    set_len(length + size);
-    if (space() >= size) {
-      int i = 0;
-      while (i < size) {
-        J_ASSERT(_buf[length] == 0, "Expected zero memory")
-        _buf[length++] = data[i++];
-      }
-      return true;
-    }
-  }
-  return false;
+  if (writeable() < size)
+    return false;
+  int length = len();
+  set_len(length + size);
+  if (len() != length + size)
+    return false;
+  memcpy(_buf + length, data, size);
+  return true;
 }
 
 int String::read(byte* data, int size)
@@ -31,6 +31,7 @@
 #endif
 
 #include "JDbg.h"
+#include "JMem.h"
 
 namespace JOS {
 
@@ -69,6 +70,15 @@ struct Input_stream {
   void rewind() {
     _ipos = 0;
   }
+  // Point data at bytes that can be read in place, and return their
+  // number. Streams that can't do that return 0, which doesn't mean
+  // there is nothing to read. Consume what was used of them.
+  virtual int peek_span(const byte** data) {
+    return 0;
+  }
+  virtual void consume(int size) {
+    skip(size);
+  }
   Input_stream(): _ipos(0) {
   }
 protected:
@@ -88,6 +98,14 @@ struct Output_stream {
   void set_pos(unsigned new_pos) {
     _opos = new_pos;
   }
+  // Point data at room that can be written in place, and return its
+  // size. Streams that can't do that return 0, which doesn't mean
+  // they're full. Commit what was written to it.
+  virtual int reserve(byte** data) {
+    return 0;
+  }
+  virtual void commit(int size) {
+  }
   Output_stream(): _opos(0) {
   }
 protected:
@@ -101,11 +119,13 @@ inline typename disabled_if<Readable<T>, OS>::type& operator<< (OS& os, const T&
   return os;
 }
 
+// Copy as much of the input as the output takes, a span at a time
+// where the streams allow. Returns the number of bytes copied.
+int copy(Output_stream& os, Input_stream& is);
+
 template<class OS>
 inline OS& operator<< (OS& os, Input_stream& is) {
-  byte b;
-  while (is.read(&b, 1))
-    os.write(&b, 1);
+  copy(os, is);
   return os;
 }
 
@@ -239,12 +259,19 @@ struct Matrix {
 };
 
 struct Memory_block: public Block {
-  Memory_block(): Block(), _capacity(0), _size(0), _buf(0) {
+  /**
+   * Construct an empty block
+   * \param arena Arena to take the memory from rather than the heap,
+   *   or zero. The block must go before the arena is reset.
+   */
+  Memory_block(Arena* arena = 0): Block(), 
+      _capacity(0), _size(0), _buf(0), _inline(0), _arena(arena) {
   }
   ~Memory_block() {
-    if (_buf != 0) {
+    if (on_heap()) {
       D_JOS("Memblock Dealloc:");
       D_JOS((int)_buf);
+      count_memory(-_capacity);
       free(_buf);
       D_JOS("Done");
     }
@@ -262,11 +289,32 @@ struct Memory_block: public Block {
     }
   }
 protected:
+  /**
+   * Construct an empty block that uses space of its owner until it
+   * needs more than that
+   */
+  Memory_block(byte* space, int space_size, Arena* arena = 0): Block(),
+      _capacity(space_size), _size(0), _buf(space), _inline(space), 
+      _arena(arena) {
+    memset(space, 0, space_size);
+  }
   static const int max_size = 0x400;
-  static const int block_bits = 4;
+  // Capacity of the first buffer taken from the heap or an arena
+  static const int min_capacity = 16;
   int _capacity;
+  // Bytes beyond the size are kept zero
   int _size;
   byte* _buf;
+private:
+  boolean on_arena() const {
+    return _arena != 0 && _arena->owns(_buf);
+  }
+  boolean on_heap() const {
+    return _buf != 0 && _buf != _inline && !on_arena();
+  }
+  byte* reallocate(int new_capacity);
+  byte* _inline;
+  Arena* _arena;
 };
 
 struct Array: public Memory_block {
@@ -299,6 +347,16 @@ struct String: public Text_stream, public Memory_block,  public Zero_terminated
     set_len(0);
     write(s);
   }
+  String(Arena& arena): Text_stream(), Memory_block(&arena), Zero_terminated(this) {
+    D_JOS("String construction on arena");
+    set_len(0);
+  }
+  String(Arena& arena, const char* s): 
+      Text_stream(), Memory_block(&arena), Zero_terminated(this) {
+    D_JOS("String construction on arena from const char*");
+    set_len(0);
+    write(s);
+  }
   
   // Ostream interface
   virtual boolean write(const byte* data, int size);
@@ -320,6 +378,13 @@ struct String: public Text_stream, public Memory_block,  public Zero_terminated
     return true;
   }
   using Text_stream::peek;
+  virtual int peek_span(const byte** data) {
+    *data = _buf + _ipos;
+    return available();
+  }
+  virtual void consume(int size) {
+    _ipos += size;
+  }
 
   // String functions
   const char* c_str() const {
@@ -350,23 +415,170 @@ struct String: public Text_stream, public Memory_block,  public Zero_terminated
     return *this;
   }
 protected:
+  String(byte* space, int space_size): 
+      Text_stream(), Memory_block(space, space_size), Zero_terminated(this) {
+    set_len(0);
+  }
   // Block interface
   virtual byte& get_item(const int index);
   virtual byte get_item(const int index) const;
 private:
-  int space() {
-    return _capacity - _size;
-  }
   virtual void resize(int newsize) {
     D_JOS("String resize");
     D_JOS(newsize);
     Memory_block::resize(newsize);
-    _buf[newsize - 1] = 0;
+    if (_size > 0)
+      _buf[_size - 1] = 0;
   }
 };
 
+/**
+ * String that keeps up to chars characters in itself, and only takes
+ * memory from the heap for longer strings
+ */
+template <int chars>
+struct Small_string: public String {
+  Small_string(): String(_memory, chars + 1) {
+  }
+  Small_string(const char* s): String(_memory, chars + 1) {
+    write(s);
+  }
+  // The copy keeps its characters in itself as well
+  Small_string(const Small_string& str): String(_memory, chars + 1) {
+    write(str.c_str());
+  }
+  using String::operator=;
+  Small_string& operator= (const Small_string& str) {
+    if (&str != this)
+      String::operator=(str);
+    return *this;
+  }
+private:
+  byte _memory[chars + 1];
+};
+
+/**
+ * String of at most chars characters that lives entirely in itself.
+ * It never allocates, so it can be used in interrupts and static
+ * tables. Writes that don't fit fail, as with a full String.
+ */
+template <int chars>
+struct Fixed_string: public Text_stream, public Block, public Zero_terminated {
+  Fixed_string(): Text_stream(), Block(), Zero_terminated(this), _size(1) {
+    _buf[0] = 0;
+  }
+  Fixed_string(const char* s): 
+      Text_stream(), Block(), Zero_terminated(this), _size(1) {
+    _buf[0] = 0;
+    write(s);
+  }
+  Fixed_string(const Fixed_string& str): 
+      Text_stream(), Block(), Zero_terminated(this), _size(str._size) {
+    memcpy(_buf, str._buf, _size);
+  }
+
+  // Block interface
+  virtual int size() const {
+    return _size;
+  }
+  virtual void resize(int new_size) {
+    if (new_size > chars + 1)
+      new_size = chars + 1;
+    if (new_size < 1)
+      new_size = 1;
+    if (new_size > _size)
+      memset(_buf + _size, 0, new_size - _size);
+    _size = new_size;
+    _buf[_size - 1] = 0;
+  }
+
+  // Ostream interface
+  virtual boolean write(const byte* data, int size) {
+    if (size > writeable())
+      return false;
+    memcpy(_buf + _size - 1, data, size);
+    _size += size;
+    _buf[_size - 1] = 0;
+    return true;
+  }
+  using Text_stream::write;
+  virtual int writeable() const {
+    return chars + 1 - _size;
+  }
+
+  // Input_stream interface
+  virtual int read(byte* data, int size) {
+    if (size > available())
+      size = available();
+    if (size <= 0)
+      return 0;
+    memcpy(data, _buf + _ipos, size);
+    _ipos += size;
+    return size;
+  }
+  using Text_stream::read;
+  virtual int available() const {
+    return len() - _ipos;
+  }
+  virtual boolean peek(byte* b) const {
+    if ((int)_ipos >= len())
+      return false;
+    *b = _buf[_ipos];
+    return true;
+  }
+  using Text_stream::peek;
+  virtual int peek_span(const byte** data) {
+    *data = _buf + _ipos;
+    return available();
+  }
+  virtual void consume(int size) {
+    _ipos += size;
+  }
+
+  // String functions
+  const char* c_str() const {
+    return (const char*)_buf;
+  }
+  void clear() {
+    set_len(0);
+    rewind();
+  }
+
+  // Operators
+  Fixed_string& operator= (const char* str) {
+    clear();
+    write(str);
+    return *this;
+  }
+  Fixed_string& operator= (const Fixed_string& str) {
+    _size = str._size;
+    memcpy(_buf, str._buf, _size);
+    rewind();
+    return *this;
+  }
+  Fixed_string& operator+= (const char* str) {
+    write(str);
+    return *this;
+  }
+protected:
+  // Block interface
+  virtual byte& get_item(const int index) {
+    if (index >= 0 && index < len())
+      return _buf[index];
+    return Block::get_item(index);
+  }
+  virtual byte get_item(const int index) const {
+    if (index >= 0 && index < len())
+      return _buf[index];
+    return 0;
+  }
+private:
+  int _size;
+  byte _buf[chars + 1];
+};
+
 struct Slice: public Text_stream, public Block, public Zero_terminated {
-  Slice(String& s, int begin, int end):  
+  Slice(Block& s, int begin, int end):  
       Text_stream(), Block(), Zero_terminated(this), _str(s), _begin(begin), _end(end) {
   }
   
@@ -404,7 +616,7 @@ protected:
     int i = begin() + index;
     int e = end();
     if (i < e)
-      return _str.data()[i];
+      return _str[i];
     else
       return Block::get_item(index);
   }
@@ -417,23 +629,27 @@ protected:
       return 0;
   }
 private:
-  String& _str;
+  // A zero terminated block, such as a string
+  Block& _str;
   int _begin;
   int _end;
+  int str_len() const {
+    return _str.size() - 1;
+  }
   int begin() const {
     if (_begin < 0) {
-      return max(0, _str.len() + _begin);
+      return max(0, str_len() + _begin);
     }
     else {
-      return max(_str.len(), _begin);
+      return max(str_len(), _begin);
     }
   }
   int end() const {
     if (_end < 1) {
-      return max(begin(), _str.len() + _end);
+      return max(begin(), str_len() + _end);
     } 
     else {
-      return min(_str.len(), _end);
+      return min(str_len(), _end);
     }
   }
 };
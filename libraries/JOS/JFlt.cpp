@@ -0,0 +1,49 @@
+/*
+  JFlt.cpp - Stream filters for JOS
+  Copyright (c) 2010 Jaap Versteegh.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "JFlt.h"
+#include <string.h>
+
+namespace JOS {
+
+void Stream_sink::flush()
+{
+  int size = _output.writeable();
+  if (size > _size)
+    size = _size;
+  if (size <= 0 || !_output.write(_buffer, size))
+    return;
+  // Keep what the output didn't take for the next time
+  _size -= size;
+  memmove(_buffer, _buffer + size, _size);
+}
+
+int Frame_buffer::take(byte* data, int size)
+{
+  if (size > _count)
+    size = _count;
+  for (int i = 0; i < size; ++i) {
+    data[i] = _data[_head];
+    _head = (_head + 1) & mask;
+  }
+  _count -= size;
+  return size;
+}
+
+}  // namespace JOS
@@ -0,0 +1,809 @@
+/*
+  JFlt.h - Stream filters for JOS
+  Copyright (c) 2010 Jaap Versteegh.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * \file
+ * Stream filters, put together in pipelines at compile time. Each
+ * filter is a template on the next stage and calls it directly, so a
+ * whole chain is one type the compiler can inline, rather than a
+ * virtual call per byte at every layer, e.g.:
+ * \code
+ * typedef JOS::Unescape<'\\', JOS::Line_splitter<
+ *     JOS::Nmea_checksum<JOS::Line_sink<82> > > > Nmea_pipeline;
+ * Nmea_pipeline pipeline(*output);
+ * ...
+ * JOS::feed(*input, pipeline);
+ * \endcode
+ * A stage has three calls: put() for every byte, end() at the end of
+ * a line or frame, telling whether it is valid, and flush() when the
+ * input has run dry for now. feed() and the sinks connect pipelines
+ * to ordinary streams. A stage that holds bytes back asks the next
+ * for its room(), the number of bytes it takes without dropping any,
+ * and tells whether it has sent() everything.
+ */
+
+#ifndef __JFLT_H__
+#define __JFLT_H__
+
+#include "JOS.h"
+#include "JCls.h"
+
+namespace JOS {
+
+/**
+ * Filter.
+ * Base of the filters: holds the next stage, which it passes ends and
+ * flushes on to unless the filter has something else to do with them.
+ * The constructor argument is passed on down to the sink.
+ */
+template <class Next>
+struct Filter {
+  Filter(): _next() {}
+  template <class A> explicit Filter(A& arg): _next(arg) {}
+  Next& next() {
+    return _next;
+  }
+  void end(const boolean valid) {
+    _next.end(valid);
+  }
+  void flush() {
+    _next.flush();
+  }
+  int room() const {
+    return _next.room();
+  }
+  boolean sent() const {
+    return _next.sent();
+  }
+protected:
+  Next _next;
+};
+
+/**
+ * Feed what is available from the input through a pipeline, a span
+ * at a time where the input allows, and flush it.
+ * \return The number of bytes fed
+ */
+template <class Pipeline>
+int feed(Input_stream& input, Pipeline& pipeline)
+{
+  int fed = 0;
+  while (true) {
+    const byte* span;
+    int size = input.peek_span(&span);
+    if (size > 0) {
+      for (int i = 0; i < size; ++i) {
+        pipeline.put(span[i]);
+      }
+      input.consume(size);
+    }
+    else {
+      const int buf_size = 16;
+      byte buf[buf_size];
+      size = input.read(buf, buf_size);
+      if (size == 0)
+        break;
+      for (int i = 0; i < size; ++i) {
+        pipeline.put(buf[i]);
+      }
+    }
+    fed += size;
+  }
+  pipeline.flush();
+  return fed;
+}
+
+/**
+ * Collapses the escape characters that EscapeFilter doubles.
+ */
+template <char escape_char, class Next>
+struct Unescape: public Filter<Next> {
+  Unescape(): Filter<Next>(), _escaped(false) {}
+  template <class A> explicit Unescape(A& arg):
+      Filter<Next>(arg), _escaped(false) {}
+  void put(const byte b) {
+    if (b == (byte)escape_char && !_escaped) {
+      _escaped = true;
+      return;
+    }
+    _escaped = false;
+    this->_next.put(b);
+  }
+private:
+  boolean _escaped;
+};
+
+/**
+ * Ends a line at every carriage return or line feed, which aren't
+ * passed on. Empty lines are skipped.
+ */
+template <class Next>
+struct Line_splitter: public Filter<Next> {
+  Line_splitter(): Filter<Next>(), _in_line(false) {}
+  template <class A> explicit Line_splitter(A& arg):
+      Filter<Next>(arg), _in_line(false) {}
+  void put(const byte b) {
+    if (b == '\r' || b == '\n') {
+      if (_in_line) {
+        _in_line = false;
+        this->_next.end(true);
+      }
+    }
+    else {
+      _in_line = true;
+      this->_next.put(b);
+    }
+  }
+private:
+  boolean _in_line;
+};
+
+/**
+ * Checks the checksum of NMEA sentences as they pass, and marks the
+ * end of the ones that don't have a valid one invalid.
+ */
+template <class Next>
+struct Nmea_checksum: public Filter<Next> {
+  Nmea_checksum(): Filter<Next>(), _state(idle), _sum(0), _expected(0) {}
+  template <class A> explicit Nmea_checksum(A& arg):
+      Filter<Next>(arg), _state(idle), _sum(0), _expected(0) {}
+  void put(const byte b) {
+    switch (_state) {
+      case idle:
+        if (b == '$' || b == '!') {
+          _state = summing;
+          _sum = 0;
+        }
+        break;
+      case summing:
+        if (b == '*')
+          _state = first_digit;
+        else
+          _sum ^= b;
+        break;
+      case first_digit:
+      case second_digit:
+        if (b >= '0' && b <= '9')
+          _expected = (_expected << 4) | (b - '0');
+        else if (b >= 'A' && b <= 'F')
+          _expected = (_expected << 4) | (b - 'A' + 10);
+        else
+          _state = invalid;
+        if (_state != invalid)
+          ++_state;
+        break;
+      default:
+        // Anything after the checksum
+        _state = invalid;
+    }
+    this->_next.put(b);
+  }
+  void end(const boolean valid) {
+    boolean checked = valid && _state == checked_sum && _sum == _expected;
+    _state = idle;
+    _expected = 0;
+    this->_next.end(checked);
+  }
+private:
+  static const byte idle = 0;
+  static const byte summing = 1;
+  static const byte first_digit = 2;
+  static const byte second_digit = 3;
+  static const byte checked_sum = 4;
+  static const byte invalid = 5;
+  byte _state;
+  byte _sum;
+  byte _expected;
+};
+
+/**
+ * Sink that writes everything to an output stream, through a small
+ * buffer so the output is written a piece at a time. What the output
+ * doesn't take when the buffer is full is dropped.
+ */
+struct Stream_sink {
+  Stream_sink(Output_stream& output): _output(output), _size(0),
+      _dropped(0) {}
+  void put(const byte b) {
+    if (_size == buf_size) {
+      flush();
+      if (_size == buf_size) {
+        ++_dropped;
+        return;
+      }
+    }
+    _buffer[_size++] = b;
+  }
+  void end(const boolean valid) {
+  }
+  void flush();
+  // Number of bytes it takes without dropping any
+  int room() const {
+    return buf_size - _size + _output.writeable();
+  }
+  // Whether everything put has gone to the output
+  boolean sent() const {
+    return _size == 0;
+  }
+  // Number of bytes the output didn't take
+  unsigned int dropped() const {
+    return _dropped;
+  }
+private:
+  static const byte buf_size = 16;
+  Output_stream& _output;
+  byte _buffer[buf_size];
+  byte _size;
+  unsigned int _dropped;
+};
+
+/**
+ * Sink that collects lines of up to chars characters and writes the
+ * valid ones to an output stream, with a carriage return and line
+ * feed. Invalid lines, lines that are too long and lines the output
+ * has no room for are counted as rejected.
+ */
+template <int chars>
+struct Line_sink {
+  Line_sink(Output_stream& output): _output(output), _length(0),
+      _lines(0), _rejected(0) {}
+  void put(const byte b) {
+    if (_length < chars)
+      _line[_length] = b;
+    // One past the line size marks a line that is too long
+    if (_length <= chars)
+      ++_length;
+  }
+  void end(const boolean valid) {
+    if (valid && _length <= chars && _output.writeable() >= _length + 2) {
+      _output.write(_line, _length);
+      _output.write((const byte*)"\r\n", 2);
+      ++_lines;
+    }
+    else {
+      ++_rejected;
+    }
+    _length = 0;
+  }
+  void flush() {
+  }
+  // Number of lines written
+  unsigned int lines() const {
+    return _lines;
+  }
+  unsigned int rejected() const {
+    return _rejected;
+  }
+private:
+  Output_stream& _output;
+  byte _line[chars];
+  int _length;
+  unsigned int _lines;
+  unsigned int _rejected;
+};
+
+/** Special characters of SLIP, RFC 1055 */
+static const byte slip_end = 0xC0;
+static const byte slip_esc = 0xDB;
+static const byte slip_esc_end = 0xDC;
+static const byte slip_esc_esc = 0xDD;
+
+/**
+ * SLIP encoder: escapes the end and escape characters and ends each
+ * frame with an end character. An empty frame is just an end, which
+ * the decoder skips.
+ */
+template <class Next>
+struct Slip_encoder: public Filter<Next> {
+  Slip_encoder(): Filter<Next>() {}
+  template <class A> explicit Slip_encoder(A& arg): Filter<Next>(arg) {}
+  void put(const byte b) {
+    if (b == slip_end) {
+      this->_next.put(slip_esc);
+      this->_next.put(slip_esc_end);
+    }
+    else if (b == slip_esc) {
+      this->_next.put(slip_esc);
+      this->_next.put(slip_esc_esc);
+    }
+    else {
+      this->_next.put(b);
+    }
+  }
+  void end(const boolean valid) {
+    this->_next.put(slip_end);
+    this->_next.end(valid);
+  }
+  // Bytes that can be encoded in room bytes, keeping room for the end
+  int writeable(const int room) const {
+    return room > 1 ? (room - 1) / 2 : 0;
+  }
+  // Whether the end of a frame is held back: never
+  boolean ending() const {
+    return false;
+  }
+};
+
+/**
+ * SLIP decoder. Frames with a bad escape are marked invalid. Ends
+ * without anything in between aren't frames, as senders may send an
+ * end before each frame to flush line noise.
+ */
+template <class Next>
+struct Slip_decoder: public Filter<Next> {
+  Slip_decoder(): Filter<Next>(), _state(idle) {}
+  template <class A> explicit Slip_decoder(A& arg):
+      Filter<Next>(arg), _state(idle) {}
+  void put(const byte b) {
+    if (b == slip_end) {
+      if (_state != idle) {
+        this->_next.end(_state == in_frame);
+      }
+      _state = idle;
+    }
+    else if (_state == escaped) {
+      if (b == slip_esc_end) {
+        this->_next.put(slip_end);
+        _state = in_frame;
+      }
+      else if (b == slip_esc_esc) {
+        this->_next.put(slip_esc);
+        _state = in_frame;
+      }
+      else {
+        _state = invalid;
+      }
+    }
+    else if (b == slip_esc) {
+      if (_state != invalid)
+        _state = escaped;
+    }
+    else {
+      if (_state == idle)
+        _state = in_frame;
+      this->_next.put(b);
+    }
+  }
+private:
+  static const byte idle = 0;
+  static const byte in_frame = 1;
+  static const byte escaped = 2;
+  static const byte invalid = 3;
+  byte _state;
+};
+
+/**
+ * Escape encoder: ends frames with a flag and replaces flags and
+ * escapes in the data with an escape followed by the character xor
+ * mask. With a flag of 0x7E, an escape of 0x7D and a mask of 0x20 it
+ * frames as HDLC and PPP do; with a mask of 0 it doubles escapes as
+ * EscapeFilter does. An empty frame is just a flag, which the decoder
+ * skips.
+ */
+template <byte flag, byte escape, byte mask, class Next>
+struct Escape_encoder: public Filter<Next> {
+  Escape_encoder(): Filter<Next>() {}
+  template <class A> explicit Escape_encoder(A& arg): Filter<Next>(arg) {}
+  void put(const byte b) {
+    if (b == flag || b == escape) {
+      this->_next.put(escape);
+      this->_next.put(b ^ mask);
+    }
+    else {
+      this->_next.put(b);
+    }
+  }
+  void end(const boolean valid) {
+    this->_next.put(flag);
+    this->_next.end(valid);
+  }
+  // Bytes that can be encoded in room bytes, keeping room for the end
+  int writeable(const int room) const {
+    return room > 1 ? (room - 1) / 2 : 0;
+  }
+  // Whether the end of a frame is held back: never
+  boolean ending() const {
+    return false;
+  }
+};
+
+/**
+ * Escape decoder, see Escape_encoder. Frames that end in an escape are
+ * marked invalid. Flags without anything in between aren't frames.
+ * With a mask of 0 a flag after an escape is data, so frames can't end
+ * in an escape.
+ */
+template <byte flag, byte escape, byte mask, class Next>
+struct Escape_decoder: public Filter<Next> {
+  Escape_decoder(): Filter<Next>(), _started(false), _escaped(false) {}
+  template <class A> explicit Escape_decoder(A& arg):
+      Filter<Next>(arg), _started(false), _escaped(false) {}
+  void put(const byte b) {
+    if (_escaped && (mask == 0 || b != flag)) {
+      this->_next.put(b ^ mask);
+      _escaped = false;
+    }
+    else if (b == flag) {
+      if (_started) {
+        this->_next.end(!_escaped);
+      }
+      _started = false;
+      _escaped = false;
+    }
+    else if (b == escape) {
+      _started = true;
+      _escaped = true;
+    }
+    else {
+      _started = true;
+      this->_next.put(b);
+    }
+  }
+private:
+  boolean _started;
+  boolean _escaped;
+};
+
+/**
+ * COBS encoder: replaces the zeros in a frame with the distance to the
+ * next one and ends the frame with a zero, so it takes at most one
+ * byte in 254 more. A block of up to 254 bytes, up to the next zero,
+ * can only be passed on once it's complete, so it holds back up to 255
+ * bytes. It passes complete blocks on as far as the next stage has
+ * room for them and the rest at the next put(), end() or flush(); only
+ * when it's full itself does it pass them on regardless. An empty
+ * frame is encoded as 01 00.
+ */
+template <class Next>
+struct Cobs_encoder: public Filter<Next> {
+  Cobs_encoder(): Filter<Next>(), _head(0), _count(0), _left(0),
+      _passing(false), _zero(false), _final(false), _ending(false),
+      _valid(false) {}
+  template <class A> explicit Cobs_encoder(A& arg): Filter<Next>(arg),
+      _head(0), _count(0), _left(0), _passing(false), _zero(false),
+      _final(false), _ending(false), _valid(false) {}
+  void put(const byte b) {
+    // The end of the previous frame goes first
+    if (_ending || _count == capacity)
+      pass(true);
+    _held[(byte)(_head + _count++)] = b;
+    if (b == 0 || _count >= block_size)
+      pass(false);
+  }
+  void end(const boolean valid) {
+    if (_ending)
+      pass(true);
+    _ending = true;
+    _valid = valid;
+    pass(false);
+  }
+  void flush() {
+    pass(false);
+    this->_next.flush();
+  }
+  // Bytes that can be taken without passing any on regardless of room
+  int writeable(const int) const {
+    return _ending ? 0 : capacity - _count;
+  }
+  // Whether the end of a frame is held back
+  boolean ending() const {
+    return _ending;
+  }
+  boolean sent() const {
+    return !_ending && this->_next.sent();
+  }
+private:
+  static const byte block_size = 254;
+  // The ring keeps one place free, so the head never meets the tail
+  static const byte capacity = 255;
+  void pass(const boolean regardless) {
+    int room = regardless ? 0x7FFF : this->_next.room();
+    while (room > 0) {
+      if (!_passing) {
+        byte length = 0;
+        while (length < _count && length < block_size &&
+            _held[(byte)(_head + length)] != 0) {
+          ++length;
+        }
+        _zero = length < _count && length < block_size;
+        _final = !_zero && length < block_size;
+        // The last block of a frame may still grow
+        if (_final && !_ending)
+          return;
+        this->_next.put(length + 1);
+        --room;
+        _left = length;
+        _passing = true;
+      }
+      while (_left != 0 && room > 0) {
+        this->_next.put(_held[_head++]);
+        --_count;
+        --_left;
+        --room;
+      }
+      if (_left != 0 || (room == 0 && _final))
+        return;
+      _passing = false;
+      if (_final) {
+        this->_next.put(0);
+        this->_next.end(_valid);
+        _ending = false;
+        return;
+      }
+      if (_zero) {
+        ++_head;
+        --_count;
+      }
+    }
+  }
+  byte _held[256];
+  // Start and number of the bytes held back
+  byte _head;
+  byte _count;
+  // Bytes of the block being passed on that have yet to go
+  byte _left;
+  // Whether the code of the block in front has gone
+  boolean _passing;
+  // Whether the block in front ends at a zero, or ends the frame
+  boolean _zero;
+  boolean _final;
+  // Whether the frame has ended, and how
+  boolean _ending;
+  boolean _valid;
+};
+
+/**
+ * COBS decoder, see Cobs_encoder. Frames that end within a block are
+ * marked invalid. 01 00 is an empty frame, but zeros without anything
+ * in between aren't frames.
+ */
+template <class Next>
+struct Cobs_decoder: public Filter<Next> {
+  Cobs_decoder(): Filter<Next>(), _started(false), _zero(false),
+      _remaining(0) {}
+  template <class A> explicit Cobs_decoder(A& arg): Filter<Next>(arg),
+      _started(false), _zero(false), _remaining(0) {}
+  void put(const byte b) {
+    if (b == 0) {
+      // The zero after the last block isn't part of the frame
+      if (_started) {
+        this->_next.end(_remaining == 0);
+      }
+      _started = false;
+      _zero = false;
+      _remaining = 0;
+    }
+    else if (_remaining == 0) {
+      // The distance to the next zero. The zero follows the block
+      // unless the block is a full one.
+      if (_zero)
+        this->_next.put(0);
+      _started = true;
+      _zero = b != 0xFF;
+      _remaining = b - 1;
+    }
+    else {
+      this->_next.put(b);
+      --_remaining;
+    }
+  }
+private:
+  boolean _started;
+  // Whether a zero is due before the next block
+  boolean _zero;
+  byte _remaining;
+};
+
+/**
+ * Encoding stream.
+ * Output stream that encodes what's written to it on to another
+ * output stream, e.g. to send SLIP frames over a serial port:
+ * \code
+ * JOS::Encoding_stream<JOS::Slip_encoder<JOS::Stream_sink> > slip(serial);
+ * slip.write(data, size);
+ * slip.end_frame();
+ * \endcode
+ * An encoder that passes everything on at once only takes what fits
+ * the output once encoded, with room left to end the frame. One that
+ * holds bytes back, as COBS does, takes what it can hold and passes it
+ * on as the output makes room, whenever writeable(), write(),
+ * end_frame() or sent() is called.
+ */
+template <class Encoder>
+struct Encoding_stream: public Output_stream {
+  Encoding_stream(Output_stream& output): Output_stream(),
+      _output(output), _encoder(output) {}
+  virtual int writeable() const {
+    _encoder.flush();
+    return _encoder.writeable(_output.writeable());
+  }
+  using Output_stream::write;
+  virtual boolean write(const byte* data, int size) {
+    if (size > writeable())
+      return false;
+    for (int i = 0; i < size; ++i) {
+      _encoder.put(data[i]);
+    }
+    _encoder.flush();
+    return true;
+  }
+  // End the frame written so far. Returns false, and doesn't, while
+  // the end of the previous frame is still held back.
+  boolean end_frame() {
+    _encoder.flush();
+    if (_encoder.ending())
+      return false;
+    _encoder.end(true);
+    _encoder.flush();
+    return true;
+  }
+  // Whether every frame ended so far has gone to the output
+  boolean sent() const {
+    _encoder.flush();
+    return _encoder.sent();
+  }
+private:
+  Output_stream& _output;
+  // Passing on what's held back doesn't change what has been written
+  mutable Encoder _encoder;
+};
+
+/**
+ * Frame buffer.
+ * Keeps a few decoded bytes of a decoding stream and the end of the
+ * frame they're from.
+ */
+struct Frame_buffer {
+  Frame_buffer(): _head(0), _count(0), _ended(false), _valid(false) {}
+  void put(const byte b) {
+    _data[(_head + _count++) & mask] = b;
+  }
+  void end(const boolean valid) {
+    _ended = true;
+    _valid = valid;
+  }
+  boolean peek(byte* b) const {
+    if (_count == 0)
+      return false;
+    *b = _data[_head];
+    return true;
+  }
+  int take(byte* data, int size);
+  byte count() const {
+    return _count;
+  }
+  byte room() const {
+    return size - _count;
+  }
+  boolean ended() const {
+    return _ended;
+  }
+  boolean valid() const {
+    return _valid;
+  }
+  void restart() {
+    _ended = false;
+    _valid = false;
+  }
+private:
+  static const byte size = 16;
+  static const byte mask = size - 1;
+  byte _data[size];
+  byte _head;
+  byte _count;
+  boolean _ended;
+  boolean _valid;
+};
+
+/** Sink of a decoding stream, that passes frames to its buffer */
+struct Frame_sink {
+  Frame_sink(Frame_buffer& buffer): _buffer(buffer) {}
+  void put(const byte b) {
+    _buffer.put(b);
+  }
+  void end(const boolean valid) {
+    _buffer.end(valid);
+  }
+  void flush() {
+  }
+private:
+  Frame_buffer& _buffer;
+};
+
+/**
+ * Decoding stream.
+ * Input stream that decodes frames from another input stream, a few
+ * bytes ahead of what is read, e.g.:
+ * \code
+ * JOS::Decoding_stream<JOS::Slip_decoder<JOS::Frame_sink> > slip(serial);
+ * while ((size = slip.read(data, max_size)) != 0) ...
+ * if (slip.frame_ended()) {
+ *   if (slip.frame_valid()) ...
+ *   slip.next_frame();
+ * }
+ * \endcode
+ * Reading stops at the end of a frame until the next one is started.
+ */
+template <class Decoder>
+struct Decoding_stream: public Input_stream {
+  Decoding_stream(Input_stream& input): Input_stream(), _input(input),
+      _decoder(_frame) {}
+  virtual int available() const {
+    decode();
+    return _frame.count();
+  }
+  virtual boolean peek(byte* b) const {
+    decode();
+    return _frame.peek(b);
+  }
+  using Input_stream::read;
+  virtual int read(byte* data, int size) {
+    int read = 0;
+    while (read < size) {
+      decode();
+      int taken = _frame.take(data + read, size - read);
+      if (taken == 0)
+        break;
+      read += taken;
+    }
+    return read;
+  }
+  // Whether the whole frame has been read
+  boolean frame_ended() const {
+    return _frame.ended() && _frame.count() == 0;
+  }
+  // Whether the frame that ended was received intact
+  boolean frame_valid() const {
+    return _frame.valid();
+  }
+  // Start reading the next frame
+  void next_frame() {
+    _frame.restart();
+  }
+private:
+  // Decode input until the frame ends or the buffer is full. It's
+  // const as far as readers can tell.
+  void decode() const {
+    // Decoding a byte may give two
+    while (!_frame.ended() && _frame.room() >= 2) {
+      const byte* span;
+      int size = _input.peek_span(&span);
+      if (size > 0) {
+        int i = 0;
+        while (i < size && !_frame.ended() && _frame.room() >= 2) {
+          _decoder.put(span[i++]);
+        }
+        _input.consume(i);
+      }
+      else {
+        byte b;
+        if (_input.read(&b, 1) == 0)
+          break;
+        _decoder.put(b);
+      }
+    }
+  }
+  Input_stream& _input;
+  mutable Frame_buffer _frame;
+  mutable Decoder _decoder;
+};
+
+}  // namespace JOS
+
+#endif
@@ -0,0 +1,104 @@
+/*
+  JMbx.cpp - Passing buffers between tasks for JOS
+  Copyright (c) 2010 Jaap Versteegh.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "JMbx.h"
+#include "JMem.h"
+#include <string.h>
+
+namespace JOS {
+
+Shared_buffer* Shared_buffer::create(const byte* data, const int size)
+{
+  Shared_buffer* buffer = 
+      (Shared_buffer*)allocate(sizeof(Shared_buffer) + size);
+  if (buffer != 0) {
+    buffer->_references = 1;
+    buffer->_size = size;
+    memcpy(buffer + 1, data, size);
+  }
+  return buffer;
+}
+
+Shared_buffer* Shared_buffer::create(Input_stream& input)
+{
+  int size = input.available();
+  Shared_buffer* buffer = 
+      (Shared_buffer*)allocate(sizeof(Shared_buffer) + size);
+  if (buffer != 0) {
+    buffer->_references = 1;
+    buffer->_size = input.read((byte*)(buffer + 1), size);
+  }
+  return buffer;
+}
+
+void Shared_buffer::release()
+{
+  J_ASSERT(_references != 0, "Shared buffer released too often");
+  if (--_references == 0) {
+    JOS::release(this);
+  }
+}
+
+Buffer_sink::~Buffer_sink()
+{
+  while (_count != 0) {
+    _queue[_head]->release();
+    _head = (_head + 1) % _depth;
+    --_count;
+  }
+}
+
+boolean Buffer_sink::send(Shared_buffer* buffer)
+{
+  if (_count == _depth)
+    return false;
+  buffer->retain();
+  _queue[(_head + _count) % _depth] = buffer;
+  ++_count;
+  _event.signal();
+  return true;
+}
+
+boolean Buffer_sink::run()
+{
+  while (_count != 0) {
+    Shared_buffer* buffer = _queue[_head];
+    int size = buffer->size() - _offset;
+    int room = _output.writeable();
+    if (size > room) {
+      size = room;
+    }
+    if (size > 0 && _output.write(buffer->data() + _offset, size)) {
+      _offset += size;
+    }
+    if (_offset < buffer->size()) {
+      // The output is full: give it time to make room
+      rest(_retry);
+      return false;
+    }
+    buffer->release();
+    _head = (_head + 1) % _depth;
+    --_count;
+    _offset = 0;
+  }
+  wait(_event);
+  return false;
+}
+
+}  // namespace JOS
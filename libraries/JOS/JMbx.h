@@ -0,0 +1,210 @@
+/*
+  JMbx.h - Buffer pools and mailboxes for JOS
+  Copyright (c) 2010 Jaap Versteegh.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * \file
+ * Passing buffers between tasks without copying them: pools that own
+ * the buffers while they're unused, mailboxes that hand them from
+ * one task to the next and shared buffers that fan out to many sinks.
+ */
+
+#ifndef __JMBX_H__
+#define __JMBX_H__
+
+#include "JOS.h"
+#include "JCls.h"
+
+namespace JOS {
+
+/**
+ * Pool.
+ * A fixed number of items of type T, allocated along with the pool.
+ * Take an item, fill it and pass it on. Whoever has it last gives it
+ * back. Taking and giving are safe from interrupt handlers.
+ */
+template <class T, byte size> struct Pool {
+  Pool(): _free(size) {
+    for (byte i = 0; i < size; ++i) {
+      _free_items[i] = &_items[i];
+    }
+  }
+  // Take an item out of the pool. Returns zero when none is left.
+  T* take() {
+    uint8_t sreg = SREG;
+    cli();
+    T* item = _free != 0 ? _free_items[--_free] : 0;
+    SREG = sreg;
+    return item;
+  }
+  // Give an item taken from this pool back
+  void give(T* item) {
+    J_ASSERT(item >= _items && item < _items + size, "Item of another pool");
+    uint8_t sreg = SREG;
+    cli();
+    _free_items[_free++] = item;
+    SREG = sreg;
+  }
+  // Number of items that can be taken
+  byte available() const {
+    return _free;
+  }
+private:
+  T _items[size];
+  T* _free_items[size];
+  volatile byte _free;
+};
+
+/**
+ * Mailbox.
+ * Queue of pointers to items, for passing them from one sender to one
+ * receiver. Ownership of an item passes with it: the sender doesn't
+ * touch it anymore after sending it, so it's never copied. Sending
+ * signals the event of the mailbox, so the receiver can wait for it
+ * rather than poll, e.g.:
+ * \code
+ * while ((sentence = mailbox.receive()) != 0) {
+ *   ...
+ *   pool.give(sentence);
+ * }
+ * wait(mailbox.event());
+ * \endcode
+ * It's a Ring underneath, so the sender may be an interrupt handler
+ * and the depth has to be a power of 2, of which one place is kept 
+ * free.
+ */
+template <class T, uint8_t depth> struct Mailbox {
+  Mailbox(): _items(), _event() {}
+  boolean empty() const {
+    return _items.empty();
+  }
+  // Send an item. Returns false when the mailbox is full, in which
+  // case the sender still owns it.
+  boolean send(T* item) {
+    if (!_items.put(item))
+      return false;
+    _event.signal();
+    return true;
+  }
+  // Receive the oldest item. Returns zero when there is none.
+  T* receive() {
+    T* item;
+    return _items.get(&item) ? item : 0;
+  }
+  // Event signalled at every send
+  Event& event() {
+    return _event;
+  }
+private:
+  Ring<T*, depth> _items;
+  Event _event;
+};
+
+/**
+ * Shared buffer.
+ * Bytes that don't change anymore once created, shared by everyone
+ * holding a reference. The buffer is freed when the last reference is
+ * released. Created with a reference for the creator, e.g.:
+ * \code
+ * JOS::Shared_buffer* buffer = JOS::Shared_buffer::create(sentence);
+ * echo.send(buffer);
+ * log.send(buffer);
+ * buffer->release();
+ * \endcode
+ * References are taken and released by tasks, not interrupt handlers.
+ */
+struct Shared_buffer {
+  // Create a buffer holding a copy of the data. Returns zero when out
+  // of memory.
+  static Shared_buffer* create(const byte* data, const int size);
+  // Create a buffer holding what is available from the input, which
+  // is read
+  static Shared_buffer* create(Input_stream& input);
+  // Take another reference. There can be up to 255 of them.
+  void retain() {
+    J_ASSERT(_references != 0xFF, "Shared buffer retained too often");
+    ++_references;
+  }
+  // Release a reference, which frees the buffer when it's the last
+  void release();
+  const byte* data() const {
+    return (const byte*)(this + 1);
+  }
+  int size() const {
+    return _size;
+  }
+  byte references() const {
+    return _references;
+  }
+private:
+  // The data follows the header in the same piece of memory
+  byte _references;
+  int _size;
+};
+
+/**
+ * Buffer sink.
+ * Task that writes shared buffers to an output stream, as fast as the
+ * output takes them. Each sink holds a reference to the buffers it
+ * has queued, so a buffer sent to several sinks isn't copied, and is
+ * freed when the slowest sink is done with it. When the output is 
+ * full, the sink rests for retry microseconds before trying again. 
+ * For a serial port, about the time it takes to send a few 
+ * characters does, e.g. 30000000 / baud for three. Use 
+ * Static_buffer_sink to get one with room for its queue.
+ */
+struct Buffer_sink: public Task {
+  Buffer_sink(Output_stream& output, Shared_buffer** queue, 
+      const byte depth, const unsigned long retry): Task(), 
+      _output(output), _queue(queue), _retry(retry), _depth(depth), 
+      _head(0), _count(0), _offset(0), _event() {}
+  ~Buffer_sink();
+  // Queue a buffer for writing. Returns false when the queue is full.
+  boolean send(Shared_buffer* buffer);
+  // Number of buffers that aren't completely written yet
+  byte queued() const {
+    return _count;
+  }
+  virtual boolean run();
+private:
+  Output_stream& _output;
+  Shared_buffer** _queue;
+  // Microseconds to rest when the output is full
+  unsigned long _retry;
+  byte _depth;
+  byte _head;
+  byte _count;
+  // Bytes of the buffer at the head written so far
+  int _offset;
+  // Signalled at every send
+  Event _event;
+};
+
+/** Buffer sink with a queue of depth buffers */
+template <byte depth>
+struct Static_buffer_sink: public Buffer_sink {
+  Static_buffer_sink(Output_stream& output, const unsigned long retry): 
+      Buffer_sink(output, _buffers, depth, retry) {}
+private:
+  Shared_buffer* _buffers[depth];
+};
+
+}  // namespace JOS
+
+
+#endif
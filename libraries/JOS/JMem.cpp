@@ -0,0 +1,269 @@
+/*
+  JMem.cpp - Memory management for JOS
+  Copyright (c) 2010 Jaap Versteegh.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "JMem.h"
+#include "JCls.h"
+#include <string.h>
+
+#if MEMORY_STATS != 0
+extern "C" {
+  // From the linker: the end of the static variables and the top of
+  // the stack
+  extern char _end;
+  extern char __stack;
+  // The heap of avr-libc, which doesn't declare its free list
+  extern char* __brkval;
+  struct __freelist {
+    size_t sz;
+    struct __freelist* nx;
+  };
+  extern struct __freelist* __flp;
+}
+#endif
+
+namespace JOS {
+
+#if MEMORY_STATS != 0
+static unsigned int memory_used = 0;
+static unsigned int memory_peak = 0;
+
+static const char stack_paint = 0xC5;
+
+// Paint the RAM above the static variables before main runs, so we
+// can tell how deep the stack has been from the paint that is left.
+// Naked, as there is no stack frame to return to yet.
+void paint_stack() __attribute__ ((naked, used, section (".init3")));
+
+void paint_stack()
+{
+  for (char* p = &_end; p <= &__stack; ++p) {
+    *p = stack_paint;
+  }
+}
+
+void count_memory(const int bytes)
+{
+  memory_used += bytes;
+  if (memory_used > memory_peak)
+    memory_peak = memory_used;
+}
+
+Memory_stats memory_stats()
+{
+  Memory_stats stats = { memory_used, memory_peak, 0, 0, 0, 0 };
+  for (__freelist* chunk = __flp; chunk != 0; chunk = chunk->nx) {
+    stats.free += chunk->sz;
+    if (chunk->sz > stats.largest_free)
+      stats.largest_free = chunk->sz;
+  }
+  char* heap_top = __brkval != 0 ? __brkval : __malloc_heap_start;
+  stats.unclaimed = (char*)SP - heap_top;
+  // The heap overwrites the paint as it grows, so start looking for
+  // the deepest the stack has been at its top
+  char* p = heap_top;
+  while (p <= &__stack && *p == stack_paint) {
+    ++p;
+  }
+  stats.stack_peak = &__stack - p + 1;
+  return stats;
+}
+
+void print_memory_stats(Output_text& out)
+{
+  Memory_stats stats = memory_stats();
+  out.write("    Used    Peak    Free Largest  Unused   Stack");
+  out.writeln();
+  out.write(Format(8), stats.used);
+  out.write(Format(8), stats.peak);
+  out.write(Format(8), stats.free);
+  out.write(Format(8), stats.largest_free);
+  out.write(Format(8), stats.unclaimed);
+  out.write(Format(8), stats.stack_peak);
+  out.writeln();
+}
+
+// avr-libc keeps the size of a chunk of the heap just before it
+static size_t chunk_size(void* ptr)
+{
+  return ((size_t*)ptr)[-1];
+}
+#endif
+
+static void* heap_allocate(size_t size)
+{
+  void* result = malloc(size);
+#if MEMORY_STATS != 0
+  if (result != 0) {
+    count_memory(chunk_size(result));
+  }
+#endif
+  return result;
+}
+
+static void heap_release(void* ptr)
+{
+#if MEMORY_STATS != 0
+  if (ptr != 0) {
+    count_memory(-chunk_size(ptr));
+  }
+#endif
+  free(ptr);
+}
+
+#if SLAB_BYTES != 0
+
+// Blocks of each slab are 1 << block_bits bytes
+static const byte block_bits[slab_count] = { 3, 4, 5, 6 };
+static const unsigned int block_counts[slab_count] = {
+  SLAB_BLOCKS_8, SLAB_BLOCKS_16, SLAB_BLOCKS_32, SLAB_BLOCKS_64
+};
+// Start of each slab in the arena, and the end of the last one
+static const unsigned int slab_offsets[slab_count + 1] = {
+  0,
+  SLAB_BLOCKS_8 * 8,
+  SLAB_BLOCKS_8 * 8 + SLAB_BLOCKS_16 * 16,
+  SLAB_BLOCKS_8 * 8 + SLAB_BLOCKS_16 * 16 + SLAB_BLOCKS_32 * 32,
+  SLAB_BYTES
+};
+
+// The slabs, one after the other, from the smallest blocks up
+static byte arena[SLAB_BYTES];
+
+// State of a slab. It's all zero to start with, so allocating works
+// during static construction already, whatever the order.
+struct Slab {
+  // Freed blocks, linked through their first bytes
+  void* free;
+  // Blocks handed out from the arena, freed or not
+  unsigned int carved;
+  Slab_stats stats;
+};
+
+static Slab slabs[slab_count];
+
+void* allocate(size_t size)
+{
+  byte i = 0;
+  while (i < slab_count && size > (1U << block_bits[i])) {
+    ++i;
+  }
+  if (i < slab_count && block_counts[i] != 0) {
+    Slab& slab = slabs[i];
+    void* block = slab.free;
+    if (block != 0) {
+      slab.free = *(void**)block;
+    }
+    else if (slab.carved < block_counts[i]) {
+      block = arena + slab_offsets[i] + (slab.carved++ << block_bits[i]);
+    }
+    if (block != 0) {
+      if (++slab.stats.used > slab.stats.peak)
+        slab.stats.peak = slab.stats.used;
+      count_memory(1 << block_bits[i]);
+      return block;
+    }
+    ++slab.stats.full;
+  }
+  return heap_allocate(size);
+}
+
+void release(void* ptr)
+{
+  byte* block = (byte*)ptr;
+  if (block >= arena && block < arena + SLAB_BYTES) {
+    unsigned int offset = block - arena;
+    byte i = 0;
+    while (offset >= slab_offsets[i + 1]) {
+      ++i;
+    }
+    Slab& slab = slabs[i];
+    *(void**)block = slab.free;
+    slab.free = block;
+    --slab.stats.used;
+    count_memory(-(1 << block_bits[i]));
+  }
+  else {
+    heap_release(ptr);
+  }
+}
+
+const Slab_stats& slab_stats(const byte i)
+{
+  return slabs[i].stats;
+}
+
+void print_slab_stats(Output_text& out)
+{
+  out.write("Block Blocks  Used    Peak    Full");
+  out.writeln();
+  for (byte i = 0; i < slab_count; ++i) {
+    const Slab_stats& stats = slabs[i].stats;
+    out.write(Format(5), 1 << block_bits[i]);
+    out.write(Format(7), block_counts[i]);
+    out.write(Format(8), stats.used);
+    out.write(Format(8), stats.peak);
+    out.write(Format(8), stats.full);
+    out.writeln();
+  }
+}
+
+#else
+
+void* allocate(size_t size)
+{
+  return heap_allocate(size);
+}
+
+void release(void* ptr)
+{
+  heap_release(ptr);
+}
+
+#endif
+
+void* Arena::allocate(const size_t size)
+{
+  if (size > _size - _used)
+    return 0;
+  _last = _used;
+  _used += size;
+  return _space + _last;
+}
+
+void* Arena::reallocate(void* ptr, const size_t size, const size_t new_size)
+{
+  if (ptr == 0)
+    return allocate(new_size);
+  if ((byte*)ptr == _space + _last) {
+    // The most recent allocation: just move the end
+    if (new_size > _size - _last)
+      return 0;
+    _used = _last + new_size;
+    return ptr;
+  }
+  if (new_size <= size)
+    return ptr;
+  void* result = allocate(new_size);
+  if (result != 0) {
+    memcpy(result, ptr, size);
+  }
+  return result;
+}
+
+}  // namespace JOS
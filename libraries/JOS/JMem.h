@@ -0,0 +1,206 @@
+/*
+  JMem.h - Memory management for JOS
+  Copyright (c) 2010 Jaap Versteegh.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * \file
+ * Memory management: the allocator behind operator new.
+ */
+
+#ifndef __JMEM_H__
+#define __JMEM_H__
+
+#include "JOS_config.h"
+
+#include <stdlib.h>
+
+// wiring.h disappeared in Arduino 1.0
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "wiring.h"
+#endif
+
+/** Bytes taken by the slabs */
+#define SLAB_BYTES (SLAB_BLOCKS_8 * 8 + SLAB_BLOCKS_16 * 16 + \
+    SLAB_BLOCKS_32 * 32 + SLAB_BLOCKS_64 * 64)
+
+namespace JOS {
+
+struct Output_text;
+
+/** Number of slabs, of blocks of 8, 16, 32 and 64 bytes */
+static const byte slab_count = 4;
+
+/** Use of the blocks of a slab */
+struct Slab_stats {
+  // Blocks in use
+  unsigned int used;
+  // Most blocks in use at any time
+  unsigned int peak;
+  // Allocations that fell back to malloc because the slab was full
+  unsigned int full;
+};
+
+/**
+ * Allocate memory. Objects of up to 64 bytes are served from the
+ * slab of the smallest blocks they fit in, which are taken from a
+ * static arena. That takes the same, short time for every block and
+ * doesn't fragment the heap, as freed blocks are only reused for
+ * objects of the same size class. Larger objects and objects whose
+ * slab is full are allocated with malloc. Set the number of blocks
+ * of each slab in JOS_config.h. This is what operator new uses.
+ * \param size Size of the memory to allocate
+ * \return The memory, or zero when out of memory
+ */
+void* allocate(size_t size);
+
+/**
+ * Free memory obtained from allocate().
+ * \param ptr The memory, or zero
+ */
+void release(void* ptr);
+
+#if SLAB_BYTES != 0
+/** Statistics of slab i, where slab i has blocks of 8 << i bytes */
+const Slab_stats& slab_stats(const byte i);
+
+/** Print a table of the statistics of the slabs */
+void print_slab_stats(Output_text& out);
+#endif
+
+/** Use of RAM, as reported by memory_stats() */
+struct Memory_stats {
+  // Bytes allocated through operator new and by memory blocks
+  unsigned int used;
+  // Most bytes allocated at any time
+  unsigned int peak;
+  // Bytes in the free list of the heap
+  unsigned int free;
+  // Largest chunk in the free list. Much less than free means the
+  // heap is fragmented.
+  unsigned int largest_free;
+  // Bytes between the top of the heap and the stack
+  unsigned int unclaimed;
+  // Most bytes the stack took at any time
+  unsigned int stack_peak;
+};
+
+#if MEMORY_STATS != 0
+/** Count bytes allocated, or freed when negative, in memory_stats() */
+void count_memory(const int bytes);
+
+/**
+ * Current use of RAM. Walks the free list of the heap and the RAM
+ * between the heap and the stack, so isn't for calling too often.
+ * The stack peak may come out on the high side after the heap has
+ * shrunk, as the heap leaves no paint behind.
+ */
+Memory_stats memory_stats();
+
+/** Print the use of RAM */
+void print_memory_stats(Output_text& out);
+#else
+inline void count_memory(const int bytes) {
+}
+#endif
+
+/**
+ * Bump pointer allocator for temporaries: memory is handed out from
+ * a fixed buffer, one piece after the other, and all of it is given
+ * back at once by resetting the arena. Both take a short, constant
+ * time and never touch the heap. Open a Scope for a unit of work,
+ * e.g. parsing a sentence, and have its Strings draw from the arena.
+ */
+struct Arena {
+  /**
+   * Remembers how much of an arena was used, and resets it to that
+   * when going out of scope. Scopes may be nested.
+   */
+  struct Scope {
+    Scope(Arena& arena): _arena(arena), _mark(arena.used()) {
+    }
+    ~Scope() {
+      _arena.reset(_mark);
+    }
+  private:
+    Arena& _arena;
+    unsigned int _mark;
+  };
+
+  /**
+   * Construct an arena
+   * \param space The memory to hand out
+   * \param size Size of the memory
+   */
+  Arena(void* space, const unsigned int size):
+      _space((byte*)space), _size(size), _used(0), _last(0) {
+  }
+  /**
+   * Allocate memory from the arena. Its memory isn't aligned, which
+   * the AVR doesn't need.
+   * \return The memory, or zero when the arena is full
+   */
+  void* allocate(const size_t size);
+  /**
+   * Resize memory allocated from the arena. The most recent
+   * allocation grows and shrinks in place, others are copied.
+   * \param ptr The memory, or zero to allocate new memory
+   * \param size Current size of the memory
+   * \param new_size Size required
+   * \return The memory, or zero when the arena is full, in which case
+   *   ptr is left as it is
+   */
+  void* reallocate(void* ptr, const size_t size, const size_t new_size);
+  /** Give back all memory allocated after used() returned mark */
+  void reset(const unsigned int mark = 0) {
+    _used = mark;
+    _last = mark;
+  }
+  /** Whether ptr was allocated from this arena */
+  boolean owns(const void* ptr) const {
+    return (const byte*)ptr >= _space && (const byte*)ptr < _space + _size;
+  }
+  /** Bytes in use */
+  unsigned int used() const {
+    return _used;
+  }
+  /** Bytes in the arena */
+  unsigned int size() const {
+    return _size;
+  }
+private:
+  byte* _space;
+  unsigned int _size;
+  unsigned int _used;
+  // Start of the most recent allocation
+  unsigned int _last;
+};
+
+/** An arena with its own memory of bytes bytes */
+template <unsigned int bytes>
+struct Static_arena: public Arena {
+  Static_arena(): Arena(_memory, bytes) {
+  }
+private:
+  byte _memory[bytes];
+};
+
+}  // namespace JOS
+
+#endif
@@ -18,12 +18,20 @@
 */
 
 #include "JOS.h"
+#include "JCls.h"
+#include "JMem.h"
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <limits.h>
 
-#if PANIC_REBOOT != 0
+#if PANIC_REBOOT != 0 || TASK_WATCHDOG != 0
 #include <avr/wdt.h>
 #endif
 
+#if TASK_WATCHDOG != 0 && !defined(WDIE)
+#error "The task watchdog needs a watchdog interrupt"
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -77,7 +85,7 @@ void panic()
 void * operator new(size_t size) throw()
 {
   D_JOS("New Alloc:");
-  void * result = malloc(size);
+  void * result = JOS::allocate(size);
   D_JOS((int)result);
 
   if (result == NULL) {
@@ -91,44 +99,159 @@ void operator delete(void * ptr) throw()
 {
   D_JOS("Delete Dealloc:");
   D_JOS((int)ptr);
-  free(ptr);
+  JOS::release(ptr);
   D_JOS("Done");
 } 
  
 namespace JOS {
 
+volatile unsigned long tick_overflows = 0;
+volatile unsigned int tick_epoch = 0;
+
+void start_clock()
+{
+  // Check the mode as well as the interrupt: when the clock was
+  // started from a static constructor, the core init() has switched
+  // timer 2 to PWM since
+#if defined(TIMSK2)
+  if ((TIMSK2 & _BV(TOIE2)) && TCCR2A == 0 && TCCR2B == _BV(CS22))
+    return;
+  // Normal mode, counting up to 255 and over, at a prescale of 64
+  TCCR2A = 0;
+  TCCR2B = _BV(CS22);
+  TIMSK2 |= _BV(TOIE2);
+#else
+  if ((TIMSK & _BV(TOIE2)) && TCCR2 == _BV(CS22))
+    return;
+  TCCR2 = _BV(CS22);
+  TIMSK |= _BV(TOIE2);
+#endif
+}
+
 void Task::rest(const unsigned long microsecs)
 {
-  _continue_at = micros() + microsecs;
+  rest_until(now() + micros_to_ticks(microsecs));
+}
+
+void Task::rest_until(const Tick at)
+{
+  start_clock();
+  if (_task_list != 0) {
+    // Take it out of the ready list, or out of the deadline queue 
+    // to requeue it at its new position
+    _task_list->detach(this);
+  }
+  _event = 0;
+  _continue_at = at;
   // zero has the special meaning: "not suspended", so avoid it here.
-  // waiting an extra microsecond won't hurt ;)
+  // waiting an extra tick won't hurt ;)
   if (_continue_at == 0) {
     _continue_at = 1;
   }
+  if (_task_list != 0) {
+    _task_list->enqueue(this);
+  }
+}
+
+void Task::wait(Event& event)
+{
+  if (event.take()) 
+    return;
+  if (_task_list != 0) {
+    _task_list->detach(this);
+  }
+  _continue_at = 0;
+  _event = &event;
+  if (_task_list != 0) {
+    _task_list->park(this);
+  }
 }
 
 boolean Task::suspended()
 {
-  if (_continue_at != 0) {
-    unsigned long diff = micros() - _continue_at;
-    boolean result = diff > 0x7FFFFFFF;
-    if (!result) {
-      _continue_at = 0;
-    }
-    return result;
+  if (waiting()) {
+    // As with resting, only a task outside a list checks for itself
+    if (_task_list != 0 || !_event->take())
+      return true;
+    _event = 0;
+    return false;
+  }
+  if (resting()) {
+    // A task list wakes its tasks through its deadline queue, so only 
+    // a task that isn't in a list has to check the clock itself
+    if (_task_list != 0)
+      return true;
+    if (now() < _continue_at)
+      return true;
+    _continue_at = 0;
+    return false;
   }
   else {
     return false;
   }
 }
 
+void Task::set_predecessor(Task* task)
+{
+  Successor* successor = new Successor;
+  successor->task = this;
+  successor->next = 0;
+  // Keep them in order, so successors start in the order they were set
+  Successor** link = &task->_successors;
+  while (*link != 0) {
+    link = &(*link)->next;
+  }
+  *link = successor;
+  ++_pending;
+}
+
+void Task::set_priority(const byte priority)
+{
+  byte level = priority < PRIORITY_LEVELS ? priority : priority_high;
+  if (_task_list != 0 && ready()) {
+    // Move it to the ready list of its new level
+    _task_list->detach(this);
+    _priority = _level = level;
+    _task_list->append(this);
+  }
+  else {
+    _priority = _level = level;
+  }
+}
+
 boolean Task::run_task()
 {
   D_JOS("Running task");
   boolean result = false;
   if (!suspended()) {
     D_JOS("Task wasn't suspended");
+#if TASK_PROFILING != 0 || TASK_BUDGET != 0
+    unsigned long start = ticks();
+#endif
+#if TASK_PROFILING != 0
+    if (_stats.due != 0) {
+      unsigned long late = start - _stats.due;
+      if (late > _stats.latest)
+        _stats.latest = late < 0xFFFF ? late : 0xFFFF;
+      _stats.due = 0;
+    }
+#endif
     result = run();
+#if TASK_PROFILING != 0 || TASK_BUDGET != 0
+    unsigned long spent = ticks() - start;
+#endif
+#if TASK_PROFILING != 0
+    ++_stats.calls;
+    _stats.total += spent;
+    if (spent > _stats.longest)
+      _stats.longest = spent < 0xFFFF ? spent : 0xFFFF;
+#endif
+#if TASK_BUDGET != 0
+    if (_budget != 0 && spent > _budget) {
+      D_JOS("Task overran its budget");
+      ++_budget_overruns;
+    }
+#endif
     ++_run_state;
   }
   else {
@@ -137,18 +260,53 @@ boolean Task::run_task()
   return result;
 }
 
+void PeriodicTask::next_period()
+{
+  Tick now = JOS::now();
+  if (!_started) {
+    // The first period starts at the first execution
+    _due = now;
+    _started = true;
+  }
+  _due += _period;
+  if (now > _due) {
+    // The next period should have started already
+    Tick late = now - _due;
+    if (_policy == skip && late > 0x7FFFFFFF) {
+      // Way behind: start over rather than dividing 64 bit numbers
+      _due = now + _period;
+      ++_overruns;
+    }
+    else if (_policy == skip) {
+      unsigned long missed = ((unsigned long)late - 1) / _period + 1;
+      _due += (Tick)missed * _period;
+      _overruns += missed;
+    }
+    else {
+      ++_overruns;
+    }
+  }
+  rest_until(_due);
+}
+
 void TaskList::add(Task* task)
 {
   D_JOS("TaskList.add()");
+  J_ASSERT(task->_pending == 0, "Task added before its predecessors completed");
   task->_task_list = this;
-  if (_size >= _list_size) {
-    _list_size += 4;
-    _list = (Task**)realloc(_list, _list_size * sizeof(Task*));
-    if (_list == NULL) {
-      panic();
-    }
+#if TASK_TRACE != 0
+  task->_reason = trace_added;
+#endif
+  // The task may have been told to rest or wait before it was added
+  if (task->resting()) {
+    enqueue(task);
+  }
+  else if (task->waiting()) {
+    park(task);
+  }
+  else {
+    append(task);
   }
-  _list[_size] = task;
   ++_size;
 }
 
@@ -157,51 +315,487 @@ int TaskList::count() const
   return _size;
 }
 
-void TaskList::run_task(int item)
+void TaskList::append(Task* task)
 {
-  if (_list[item]->run_task()) {
-    // When run_task returned true, the task is complete
-    D_JOS("Task finished");
-    Task* finished_task = _list[item];
-    if (finished_task->_next != 0) {
-      // Continue with next sequential task
-      _list[item] = finished_task->_next;
-      _list[item]->prev_completed(finished_task);
+  byte level = task->_level;
+  task->_prev_link = _ready_tail[level];
+  task->_next_link = 0;
+  if (_ready_tail[level] != 0) {
+    _ready_tail[level]->_next_link = task;
+  }
+  else {
+    _ready[level] = task;
+  }
+  _ready_tail[level] = task;
+  ++_ready_count;
+}
+
+void TaskList::detach(Task* task)
+{
+  Task** head;
+  Task** tail = 0;
+  if (task->resting()) {
+    head = &_resting;
+  }
+  else if (task->waiting()) {
+    head = &task->_event->_waiting;
+  }
+  else {
+    head = &_ready[task->_level];
+    tail = &_ready_tail[task->_level];
+    --_ready_count;
+  }
+  Task* prev = task->_prev_link;
+  Task* next = task->_next_link;
+  if (prev != 0) {
+    prev->_next_link = next;
+  }
+  else {
+    *head = next;
+  }
+  if (next != 0) {
+    next->_prev_link = prev;
+  }
+  else if (tail != 0) {
+    *tail = prev;
+  }
+  task->_prev_link = 0;
+  task->_next_link = 0;
+}
+
+void TaskList::enqueue(Task* task)
+{
+  // Insert behind all tasks that are due at or before this one, so
+  // tasks with equal deadlines continue in the order they rested
+  Task* prev = 0;
+  Task* next = _resting;
+  while (next != 0 && next->_continue_at <= task->_continue_at) {
+    prev = next;
+    next = next->_next_link;
+  }
+  task->_prev_link = prev;
+  task->_next_link = next;
+  if (prev != 0) {
+    prev->_next_link = task;
+  }
+  else {
+    _resting = task;
+  }
+  if (next != 0) {
+    next->_prev_link = task;
+  }
+}
+
+void TaskList::wake(const Tick now)
+{
+  // The queue is sorted, so we're done at the first task that isn't due
+  while (_resting != 0 && _resting->_continue_at <= now) {
+    Task* task = _resting;
+    _resting = task->_next_link;
+    if (_resting != 0) {
+      _resting->_prev_link = 0;
+    }
+#if TASK_PROFILING != 0
+    // Remember the deadline for measuring the lateness
+    task->_stats.due = task->_continue_at;
+    if (task->_stats.due == 0)
+      task->_stats.due = 1;
+#endif
+    task->_continue_at = 0;
+#if TASK_TRACE != 0
+    task->_reason = trace_rested;
+#endif
+    append(task);
+  }
+}
+
+void TaskList::park(Task* task)
+{
+  Event* event = task->_event;
+  J_ASSERT(!event->_listed || event->_signalled == &_signalled,
+      "Event waited for in two task lists");
+  // Line up behind the tasks that are waiting already
+  Task* prev = event->_waiting;
+  if (prev != 0) {
+    while (prev->_next_link != 0) {
+      prev = prev->_next_link;
+    }
+    prev->_next_link = task;
+  }
+  else {
+    event->_waiting = task;
+  }
+  task->_prev_link = prev;
+  task->_next_link = 0;
+  if (!event->_listed) {
+    event->_listed = true;
+    event->_next_event = _events;
+    _events = event;
+    uint8_t sreg = SREG;
+    cli();
+    event->_signalled = &_signalled;
+    // It may have been signalled since the task tried to take it
+    if (event->_count != 0)
+      _signalled = true;
+    SREG = sreg;
+  }
+}
+
+void TaskList::release()
+{
+  // Clear the flag first: a signal arriving while we go sets it again
+  _signalled = false;
+  Event** link = &_events;
+  while (*link != 0) {
+    Event* event = *link;
+    // Hand out the signals to the waiting tasks in order of arrival
+    while (event->_waiting != 0 && event->take()) {
+      Task* task = event->_waiting;
+      detach(task);
+      task->_event = 0;
+#if TASK_TRACE != 0
+      task->_reason = trace_event;
+#endif
+      append(task);
+    }
+    if (event->_waiting == 0) {
+      *link = event->_next_event;
+      event->_listed = false;
+      uint8_t sreg = SREG;
+      cli();
+      event->_signalled = 0;
+      SREG = sreg;
     }
     else {
-      // Clean up
-      --_size;
-      while (item < _size) {
-        _list[item] = _list[item + 1];
-        ++item;
-      }
-      if ((_list_size - _size) > 4) {
-        _list_size -= 4;
-        _list = (Task**)realloc(_list, _list_size * sizeof(Task*));
-        if (_list == NULL) {
-          panic();
-        }
+      link = &event->_next_event;
+    }
+  }
+}
+
+void TaskList::idle()
+{
+  unsigned long microsecs = ULONG_MAX;
+  if (_resting != 0) {
+    Tick at = now();
+    if (_resting->_continue_at <= at)
+      return;
+    Tick left = _resting->_continue_at - at;
+    // Don't overflow the microseconds
+    if (left < micros_to_ticks(ULONG_MAX))
+      microsecs = ticks_to_micros(left);
+  }
+  // Check for signals with interrupts disabled, so none can come in
+  // between the check and going to sleep
+  cli();
+  if (!_signalled) {
+    _idle_handler(microsecs);
+  }
+  sei();
+}
+
+Task* TaskList::next_task()
+{
+  int level = PRIORITY_LEVELS - 1;
+  while (_ready[level] == 0) {
+    if (level == 0)
+      return 0;
+    --level;
+  }
+  Task* task = _ready[level];
+  // Queue it up behind the other tasks of its own level for its next
+  // turn. An aged task goes back to its own priority now it got one.
+  detach(task);
+  task->_level = task->_priority;
+  append(task);
+  age(level);
+  return task;
+}
+
+void TaskList::age(const int served)
+{
+  _starved[served] = 0;
+  for (int level = served - 1; level >= 0; --level) {
+    if (_ready[level] == 0) {
+      _starved[level] = 0;
+    }
+    else if (++_starved[level] >= PRIORITY_AGING) {
+      // Promote the task that has been waiting longest in this level
+      _starved[level] = 0;
+      Task* task = _ready[level];
+      detach(task);
+      task->_level = level + 1;
+      append(task);
+    }
+  }
+}
+
+void TaskList::run_task(Task* task)
+{
+#if TASK_TRACE != 0
+  unsigned long start = ticks();
+#endif
+#if TASK_WATCHDOG != 0
+  // The task may run a task list of its own, so remember the outer task
+  Task* outer = _current;
+  _current = task;
+  task->_window = _window;
+  boolean done = task->run_task();
+  _current = outer;
+#else
+  boolean done = task->run_task();
+#endif
+#if TASK_TRACE != 0
+  trace(task, start);
+  task->_reason = trace_ready;
+#endif
+  if (done) {
+    // When run_task returned true, the task is complete
+    D_JOS("Task finished");
+    detach(task);
+    --_size;
+    // Continue with the successors that were waiting for this task only
+    Task::Successor* successor = task->_successors;
+    while (successor != 0) {
+      Task* next = successor->task;
+      next->prev_completed(task);
+      if (--next->_pending == 0) {
+        add(next);
       }
+      Task::Successor* done = successor;
+      successor = successor->next;
+      delete done;
     }
     D_JOS("Deleting finished task");
-    delete finished_task;
+    delete task;
   } 
 }
 
 void TaskList::run()
 {
-  // run high priority tasks first
-  for (int i = 0; i < _size; ++i) {
-    if (_list[i]->_high_priority) {
-      run_task(i);
+  start_clock();
+  // Read the clock once per pass rather than once per task
+  Tick now = JOS::now();
+  wake(now);
+  if (_signalled) {
+    release();
+  }
+  // Give as many turns as there are tasks ready to run, but pick the 
+  // task of the highest priority for each of them
+  for (int turns = _ready_count; turns > 0; --turns) {
+    // Tasks woken up by an interrupt go ahead at the next dispatch
+    if (_signalled) {
+      release();
+    }
+    Task* task = next_task();
+    if (task == 0)
+      break;
+    run_task(task);
+  }
+#if TASK_WATCHDOG != 0
+  if (_watching) {
+    kick((unsigned long)now);
+  }
+#endif
+  // Nothing left to run until the first resting task is due
+  if (_idle_handler != 0 && _ready_count == 0) {
+    idle();
+  }
+}
+
+#if TASK_PROFILING != 0
+void TaskList::print_stats(Output_text& out) const
+{
+  out.write("Task    Calls     Total(us) Max(us) Late(us)");
+  out.writeln();
+  for (int level = PRIORITY_LEVELS - 1; level >= 0; --level) {
+    print_stats(out, _ready[level]);
+  }
+  print_stats(out, _resting);
+  for (Event* event = _events; event != 0; event = event->_next_event) {
+    print_stats(out, event->_waiting);
+  }
+}
+
+void TaskList::print_stats(Output_text& out, const Task* task)
+{
+  for (; task != 0; task = task->_next_link) {
+    const Task_stats& stats = task->_stats;
+    out.write(Format(6, 16, 0, '0'), (unsigned long)task);
+    out.write(Format(8), stats.calls);
+    out.write(Format(14), ticks_to_micros(stats.total));
+    out.write(Format(8), ticks_to_micros(stats.longest));
+    out.write(Format(9), ticks_to_micros(stats.latest));
+    out.writeln();
+  }
+}
+#endif
+
+#if TASK_WATCHDOG != 0
+// The task that stalled the task list and its complement, for telling
+// it from garbage. They're not initialized at startup, so they survive
+// the reboot after a panic.
+static const Task* stalled __attribute__ ((section (".noinit")));
+static size_t stalled_check __attribute__ ((section (".noinit")));
+
+const Task* stalled_task()
+{
+  return stalled_check == ~(size_t)stalled ? stalled : 0;
+}
+
+Task* volatile TaskList::_current = 0;
+
+void TaskList::start_watchdog()
+{
+  stalled_check = 0;
+  _watching = true;
+  _kicked = ticks();
+  ++_window;
+  uint8_t sreg = SREG;
+  cli();
+  wdt_reset();
+  // Timed sequence for setting the timeout: interrupt only, no reset
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = _BV(WDIE) | (WATCHDOG_TIMEOUT & 0x07) | 
+      ((WATCHDOG_TIMEOUT & 0x08) ? _BV(WDP3) : 0);
+  SREG = sreg;
+}
+
+void TaskList::kick(const unsigned long now)
+{
+  // Checking for progress takes a walk through the ready lists, so 
+  // only check once per half of the timeout (which is 16 ms << timeout)
+  if (now - _kicked < micros_to_ticks(8000UL << WATCHDOG_TIMEOUT))
+    return;
+  // Tasks that rest or wait aren't expected to run, but all others 
+  // should have had a turn since the last kick
+  for (int level = 0; level < PRIORITY_LEVELS; ++level) {
+    for (Task* task = _ready[level]; task != 0; task = task->_next_link) {
+      if (task->_window != _window)
+        return;
     }
   }
-  for (int i = 0; i < _size; ++i) {
-    run_task(i);
+  wdt_reset();
+  _kicked = now;
+  ++_window;
+}
+
+static void stall(Task* task)
+{
+  stalled = task;
+  stalled_check = ~(size_t)task;
+  D_JOS("Task stalled the task list:");
+  D_JOS((int)task);
+}
+#endif
+
+#if TASK_TRACE != 0
+void TaskList::trace(const Task* task, const unsigned long start)
+{
+  if (_trace_paused)
+    return;
+  unsigned long length = ticks() - start;
+  Trace_record& record = _trace[_trace_next];
+  record.task = (unsigned int)(size_t)task;
+  record.start = start;
+  record.length = length < 0xFFFF ? length : 0xFFFF;
+  record.reason = task->_reason;
+  _trace_next = (_trace_next + 1) & (TASK_TRACE - 1);
+  if (_trace_count < TASK_TRACE) 
+    ++_trace_count;
+}
+
+/** Task that writes the trace of a task list to a stream */
+struct Trace_dump: public Task {
+  Trace_dump(TaskList& list, Output_stream& out): Task(), _list(list),
+      _out(out), _left(list._trace_count), _header(true) {
+    // Start at the oldest record
+    _index = _left < TASK_TRACE ? 0 : list._trace_next;
+    list._trace_paused = true;
   }
+protected:
+  virtual boolean run() {
+    byte chunk[chunk_size];
+    while (_out.writeable() >= chunk_size) {
+      if (_header) {
+        unsigned int tick_nanosecs = ticks_to_micros(1000);
+        chunk[0] = 0xFE;
+        memcpy(chunk + 1, "JTRC", 4);
+        chunk[5] = 1; // Version
+        memcpy(chunk + 6, &tick_nanosecs, 2);
+        memcpy(chunk + 8, &_left, 2);
+        _header = false;
+      }
+      else if (_left > 0) {
+        chunk[0] = 0xFF;
+        const Trace_record& record = _list._trace[_index];
+        memcpy(chunk + 1, &record.task, 2);
+        memcpy(chunk + 3, &record.start, 4);
+        memcpy(chunk + 7, &record.length, 2);
+        chunk[9] = record.reason;
+        _index = (_index + 1) & (TASK_TRACE - 1);
+        --_left;
+      }
+      else {
+        // All done: start over with an empty trace
+        _list._trace_count = 0;
+        _list._trace_next = 0;
+        _list._trace_paused = false;
+        return true;
+      }
+      _out.write(chunk, chunk_size);
+    }
+    return false;
+  }
+private:
+  static const int chunk_size = 10;
+  TaskList& _list;
+  Output_stream& _out;
+  unsigned int _index;
+  unsigned int _left;
+  boolean _header;
+};
+
+Task* TaskList::dump_trace(Output_stream& out)
+{
+  return new Trace_dump(*this, out);
+}
+#endif
+
+void idle_sleep(unsigned long microsecs)
+{
+  // Waking up takes a pass through the task list anyway, so sleeping
+  // makes no sense when the first task is due before the next timer tick
+  if (microsecs < 1024)
+    return;
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  // We're called with interrupts disabled, and they're enabled again
+  // only after the instruction following sei, so an interrupt that
+  // comes in now wakes us up rather than being handled before the sleep
+  sei();
+  sleep_cpu();
+  sleep_disable();
 }
 
 /* Global task list */
 TaskList tasks;
 
 }  // namespace JOS
+
+#if TASK_WATCHDOG != 0
+ISR(WDT_vect)
+{
+  // Stop the watchdog interrupt, so it doesn't interrupt the panic
+  WDTCSR &= ~_BV(WDIE);
+  JOS::stall(JOS::TaskList::current());
+  // The panic led is timed by the timer interrupt
+  sei();
+  panic();
+}
+#endif
+
+ISR(TIMER2_OVF_vect)
+{
+  if (++JOS::tick_overflows == 0)
+    ++JOS::tick_epoch;
+}
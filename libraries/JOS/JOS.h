@@ -43,8 +43,9 @@
 
 #undef round
 #include <math.h>
+#include <avr/interrupt.h>
 
-#if PANIC_REBOOT != 0
+#if PANIC_REBOOT != 0 || TASK_WATCHDOG != 0
 #include <avr/wdt.h>
 #endif
 
@@ -89,28 +90,301 @@ void operator delete(void * ptr) throw();
  */
 void panic();
 
+#if PRIORITY_LEVELS < 2
+#error "At least 2 priority levels are required"
+#endif
+
+#if (TASK_TRACE & (TASK_TRACE - 1)) != 0
+#error "The trace size has to be a power of 2"
+#endif
+
 namespace JOS {
 
+struct Output_text;
+struct Output_stream;
+
+/** Number of processor cycles per tick of the clock */
+static const unsigned long tick_cycles = 64;
+
+/** Time in ticks since startup. It won't wrap in our lifetime. */
+typedef unsigned long long Tick;
+
+/** 
+ * Overflow count of the clock timer and its upper bits. Kept by the 
+ * clock interrupt: leave them alone.
+ */
+extern volatile unsigned long tick_overflows;
+extern volatile unsigned int tick_epoch;
+
+// Registers of the clock timer, timer 2
+#if defined(TIFR2)
+#define JOS_CLOCK_TIFR TIFR2
+#else
+#define JOS_CLOCK_TIFR TIFR
+#endif
+
+/**
+ * Start the clock. JOS takes timer 2 for it, so that is no longer 
+ * available for PWM on its pins nor for tone(). It's started when the 
+ * first task rests or a task list first runs. Start it yourself when 
+ * using the clock before that.
+ */
+void start_clock();
+
+/**
+ * Clock.
+ * Counts ticks of 64 processor cycles (4 us at 16 MHz) from the timer
+ * 2 counter and overflow count, without disabling interrupts as 
+ * micros() does. As the tick count has 64 bits, times can be compared
+ * directly, without wraparound arithmetic. Works in interrupt handlers
+ * as well.
+ * \return Ticks since the clock was started
+ */
+inline Tick now() 
+{
+  uint8_t count;
+  unsigned long overflows;
+  unsigned int epoch;
+  boolean pending;
+  // Read again when the clock interrupt came in between
+  do {
+    overflows = tick_overflows;
+    epoch = tick_epoch;
+    count = TCNT2;
+    pending = JOS_CLOCK_TIFR & _BV(TOV2);
+  } while (overflows != tick_overflows);
+  Tick result = ((Tick)epoch << 32) | overflows;
+  // Count an overflow that is yet to be handled by the interrupt
+  if (pending && count < 255)
+    ++result;
+  return (result << 8) | count;
+}
+
+/**
+ * Cheap clock.
+ * The lower 32 bits of the clock, for timing short intervals with 
+ * wraparound arithmetic. Wraps every 4.7 hours at 16 MHz.
+ * \return Ticks since the clock was started, modulo 2^32
+ */
+inline unsigned long ticks() 
+{
+  uint8_t count;
+  unsigned long overflows;
+  boolean pending;
+  do {
+    overflows = tick_overflows;
+    count = TCNT2;
+    pending = JOS_CLOCK_TIFR & _BV(TOV2);
+  } while (overflows != tick_overflows);
+  if (pending && count < 255)
+    ++overflows;
+  return (overflows << 8) | count;
+}
+
+inline unsigned long ticks_to_micros(const unsigned long t) 
+{
+  return t * (tick_cycles / clockCyclesPerMicrosecond());
+}
+
+inline unsigned long micros_to_ticks(const unsigned long microsecs) 
+{
+  return microsecs / (tick_cycles / clockCyclesPerMicrosecond());
+}
+
+inline Tick seconds_to_ticks(const unsigned long seconds) 
+{
+  return (Tick)seconds * 
+      (1000000UL / (tick_cycles / clockCyclesPerMicrosecond()));
+}
+
+#if TASK_PROFILING != 0
+/**
+ * Execution statistics of a task. Times are in ticks.
+ */
+struct Task_stats {
+  Task_stats(): calls(0), total(0), longest(0), latest(0), due(0) {}
+  // Number of executions
+  unsigned long calls;
+  // Total time spent in run()
+  unsigned long total;
+  // Longest time spent in a single run()
+  unsigned int longest;
+  // Largest delay between the end of a rest and the start of run()
+  unsigned int latest;
+  // Tick the task was due after its last rest, zero when it wasn't
+  unsigned long due;
+};
+#endif
+
+/**
+ * Idle handler.
+ * Called by the task list when none of its tasks is runnable. It 
+ * may return at any time, but shouldn't stay away much longer than
+ * the time until the first task is due. It's called with interrupts
+ * disabled, so an event can't be signalled unnoticed before it goes
+ * to sleep. Enable them together with sleeping, as in sei(); 
+ * sleep_cpu();. The task list enables them after it returns.
+ * \param microsecs Time until the first resting task is due
+ */
+typedef void (*Idle_handler)(unsigned long microsecs);
+
+/**
+ * Default idle handler.
+ * Puts the processor in idle sleep until the next interrupt. The timer
+ * interrupt that keeps micros() going wakes it up at least every 
+ * millisecond.
+ */
+void idle_sleep(unsigned long microsecs);
 
+struct Task;
 struct TaskList;
 
+#if TASK_WATCHDOG != 0
+/**
+ * Task that stalled the task list when the watchdog fired, before the
+ * reboot that followed. Zero when the watchdog didn't fire. Call it 
+ * before starting the watchdog to find out what went wrong.
+ */
+const Task* stalled_task();
+#endif
+
+#if TASK_TRACE != 0
+/**
+ * Dispatch of a task, as recorded in the trace of a task list.
+ */
+struct Trace_record {
+  // Address of the task
+  unsigned int task;
+  // ticks() at the start of run()
+  unsigned long start;
+  // Ticks spent in run()
+  unsigned int length;
+  // Why the task was ready to run
+  byte reason;
+};
+
+// Reasons for a task to run
+static const byte trace_ready = 0;  // It was ready and ran before
+static const byte trace_added = 1;  // It was just added to the list
+static const byte trace_rested = 2; // It was done resting
+static const byte trace_event = 3;  // Its event was signalled
+#endif
+
+/**
+ * Event.
+ * Binary or counting semaphore a task can wait for. Signalling it is 
+ * cheap and safe from interrupt handlers, so tasks can be woken up 
+ * by an interrupt instead of polling. Tasks waiting for the same event
+ * at the same time have to be in the same task list, as the list that
+ * hands out its signals moves them to its own ready list.
+ */
+struct Event {
+  Event(const byte max_count = 1): _count(0), _max_count(max_count),
+      _listed(false), _waiting(0), _next_event(0), _signalled(0) {}
+  // Signal the event. The first waiting task runs at the next dispatch.
+  void signal() {
+    uint8_t sreg = SREG;
+    cli();
+    if (_count < _max_count) 
+      ++_count;
+    if (_signalled != 0)
+      *_signalled = true;
+    SREG = sreg;
+  }
+  // Take a signal without waiting. Returns false when there was none.
+  boolean take() {
+    uint8_t sreg = SREG;
+    cli();
+    boolean taken = _count != 0;
+    if (taken)
+      --_count;
+    SREG = sreg;
+    return taken;
+  }
+  byte count() const {
+    return _count;
+  }
+  friend class Task;
+  friend class TaskList;
+private:
+  volatile byte _count;
+  byte _max_count;
+  // Whether the event is in the event list of a task list
+  boolean _listed;
+  // Tasks waiting for the event, in order of arrival
+  Task* _waiting;
+  Event* _next_event;
+  // Flag of the task list the event is listed in, set when the event
+  // is signalled so the list knows to look. Only changed with 
+  // interrupts disabled.
+  volatile boolean* _signalled;
+};
+
 struct Task {
-  Task(): _run_state(0), _running(false), _high_priority(false),
-      _continue_at(0), _next(0), _task_list(0) {}
+  Task(): _run_state(0), _running(false), _priority(priority_normal),
+      _level(priority_normal), _pending(0), _continue_at(0), _event(0), 
+      _successors(0), _task_list(0), _prev_link(0), _next_link(0) {
+#if TASK_BUDGET != 0
+    _budget = 0;
+    _budget_overruns = 0;
+#endif
+#if TASK_WATCHDOG != 0
+    _window = 0;
+#endif
+#if TASK_TRACE != 0
+    _reason = trace_added;
+#endif
+  }
   // Don't destroy tasks explicitly, but rather have the "run"
   // method return true. This signals task completion upon 
   // which the tasklist will delete the task
   virtual ~Task() {}
   // rest before start of next execution 
   void rest(const unsigned long microsecs);
-  
+  // rest until the clock reaches the given tick, which may be as far
+  // ahead as you like, e.g. now() + seconds_to_ticks(86400)
+  void rest_until(const Tick at);
+  // wait for a signal of the event before the next execution. Continues
+  // right away when the event has been signalled already.
+  void wait(Event& event);
+
+  // Priority levels. Tasks of a higher priority run first at every 
+  // dispatch. Tasks that have waited too long are temporarily promoted.
+  static const byte priority_low = 0;
+  static const byte priority_normal = 1;
+  static const byte priority_high = PRIORITY_LEVELS - 1;
+  void set_priority(const byte priority);
+  byte priority() const {
+    return _priority;
+  }
   void boost_priority() {
-    _high_priority = true;
+    set_priority(priority_high);
   }   
-  void set_predecessor(Task* task) {
-    task->_next = this;
+  // Have this task continue after the given task. A task can have 
+  // several predecessors, in which case it continues once all of them 
+  // have completed, and several successors, which all continue after 
+  // it. prev_completed is called for each predecessor as it completes. 
+  // Don't add the task to a task list yourself: it's added to the list
+  // of the predecessor that completes last.
+  void set_predecessor(Task* task);
+#if TASK_PROFILING != 0
+  const Task_stats& stats() const {
+    return _stats;
   }
+#endif
+#if TASK_BUDGET != 0
+  // Longest a single run of the task should take. Zero for no budget.
+  void set_budget(const unsigned long microsecs) {
+    unsigned long budget = micros_to_ticks(microsecs);
+    _budget = budget < 0xFFFF ? budget : 0xFFFF;
+  }
+  // Number of runs that took longer than the budget
+  unsigned int budget_overruns() const {
+    return _budget_overruns;
+  }
+#endif
   friend class TaskList;
+  friend class Static_dispatch;
 protected:
   static const int run_state_default = 0xFE;
   byte _run_state;
@@ -119,21 +393,359 @@ protected:
   virtual boolean suspended();
 private:
   boolean _running;
-  boolean _high_priority;
-  unsigned long _continue_at;
-  Task* _next; 
+  byte _priority;
+  // Level of the ready list the task is in: its priority, unless aged
+  byte _level;
+  // Number of predecessors that have yet to complete
+  byte _pending;
+  // Tick at which to continue, zero when not resting
+  Tick _continue_at;
+  // Event the task is waiting for
+  Event* _event;
+  // Tasks that continue after this one
+  struct Successor {
+    Task* task;
+    Successor* next;
+  };
+  Successor* _successors;
   TaskList* _task_list;
+  // Neighbours in the ready list of the task list or, while resting
+  // or waiting, in its deadline queue or the waiting list of the event
+  Task* _prev_link;
+  Task* _next_link;
+#if TASK_PROFILING != 0
+  Task_stats _stats;
+#endif
+#if TASK_BUDGET != 0
+  // Budget in ticks
+  unsigned int _budget;
+  unsigned int _budget_overruns;
+#endif
+#if TASK_WATCHDOG != 0
+  // Watchdog window of the task list in which the task last had a turn
+  byte _window;
+#endif
+#if TASK_TRACE != 0
+  // Why the task is ready to run, for the trace
+  byte _reason;
+#endif
 
   boolean run_task();
+  boolean resting() const {
+    return _continue_at != 0;
+  }
+  boolean waiting() const {
+    return _event != 0;
+  }
+  boolean ready() const {
+    return !resting() && !waiting();
+  }
+};
+
+/**
+ * Periodic task.
+ * A task that runs at a fixed rate. Its periods are scheduled against
+ * the start of the previous period rather than against the current 
+ * time, so they don't drift by the execution time and the jitter of 
+ * the task list.
+ */
+struct PeriodicTask: public Task {
+  // What to do when a task is late for the start of its next period
+  static const byte catch_up = 0; // Run it right away, until on schedule again
+  static const byte skip = 1;     // Skip the missed periods
+  PeriodicTask(const unsigned long period, const byte policy = skip): 
+      Task(), _period(period_ticks(period)), _due(0), _overruns(0), 
+      _policy(policy),
+      _started(false) {}
+  unsigned long period() const {
+    return ticks_to_micros(_period);
+  }
+  // Set the period. Takes effect after the current period.
+  void set_period(const unsigned long period) {
+    _period = period_ticks(period);
+  }
+  // Number of periods that started late or were skipped
+  unsigned int overruns() const {
+    return _overruns;
+  }
+protected:
+  // Rest until the start of the next period. Call it from run() 
+  // instead of rest().
+  void next_period();
+private:
+  // A period of at least one tick, so periods keep moving on
+  static unsigned long period_ticks(const unsigned long period) {
+    unsigned long ticks = micros_to_ticks(period);
+    return ticks != 0 ? ticks : 1;
+  }
+  // Period in ticks
+  unsigned long _period;
+  // Start of the current period
+  Tick _due;
+  unsigned int _overruns;
+  byte _policy;
+  boolean _started;
+};
+
+/** Function that does work deferred from an interrupt handler */
+typedef void (*Work_function)(void* context);
+
+/** Deferred work: a function and what to call it with */
+struct Work {
+  Work_function function;
+  void* context;
+};
+
+/**
+ * Ring.
+ * Lock free queue of items of type T, for one producer and one 
+ * consumer, such as an interrupt handler and a task. Neither side 
+ * needs to disable interrupts. The size has to be a power of 2 and one
+ * place is kept free to tell a full queue from an empty one.
+ */
+template <class T, uint8_t size> struct Ring {
+  Ring(): _head(0), _tail(0) {}
+  boolean empty() const {
+    return _head == _tail;
+  }
+  // Producer side. Returns false when the queue is full.
+  boolean put(const T& item) {
+    uint8_t head = _head;
+    uint8_t next = (head + 1) & mask;
+    if (next == _tail)
+      return false;
+    _items[head] = item;
+    // Make sure the item is stored before it is published
+    __asm__ __volatile__ ("" ::: "memory");
+    _head = next;
+    return true;
+  }
+  // Consumer side. Returns false when the queue is empty.
+  boolean get(T* item) {
+    uint8_t tail = _tail;
+    if (tail == _head)
+      return false;
+    // Make sure the item is read after it was published
+    __asm__ __volatile__ ("" ::: "memory");
+    *item = _items[tail];
+    _tail = (tail + 1) & mask;
+    return true;
+  }
+private:
+  static const uint8_t mask = size - 1;
+  // Fails to compile when the size isn't a power of 2
+  typedef char size_check[(size & mask) == 0 ? 1 : -1];
+  T _items[size];
+  volatile uint8_t _head;
+  volatile uint8_t _tail;
+};
+
+/** Ring of deferred work */
+template <uint8_t size> struct Work_queue: public Ring<Work, size> {
+  using Ring<Work, size>::put;
+  // Producer side. Returns false when the queue is full.
+  boolean put(Work_function function, void* context) {
+    Work work = { function, context };
+    return put(work);
+  }
+};
+
+/**
+ * Bottom half.
+ * Task that does the work deferred to it by interrupt handlers. Post
+ * the work from the handler and it gets done at the next dispatch of 
+ * the task, in task context. Only a single interrupt handler, or 
+ * handlers that can't interrupt each other, should post to it.
+ */
+template <uint8_t size> struct Bottom_half: public Task {
+  Bottom_half(): Task(), _queue(), _posted() {}
+  // Post work. Returns false when the queue is full.
+  boolean post(Work_function function, void* context = 0) {
+    if (!_queue.put(function, context))
+      return false;
+    _posted.signal();
+    return true;
+  }
+protected:
+  virtual boolean run() {
+    Work work;
+    while (_queue.get(&work)) {
+      work.function(work.context);
+    }
+    wait(_posted);
+    return false;
+  }
+private:
+  Work_queue<size> _queue;
+  Event _posted;
+};
+
+/**
+ * Direct dispatch of a task of a known type, for StaticTaskList. 
+ * Checks the rest and wait of the task against the time of the pass
+ * and calls its run method without going through the vtable.
+ */
+struct Static_dispatch {
+  template <class T> 
+  static boolean run(T& task, const Tick now) {
+    Task& base = task;
+    if (base.resting()) {
+      if (now < base._continue_at)
+        return false;
+      base._continue_at = 0;
+    }
+    if (base.waiting()) {
+      if (!base._event->take())
+        return false;
+      base._event = 0;
+    }
+    if (task.T::suspended())
+      return false;
+    boolean result = task.T::run();
+    ++base._run_state;
+    return result;
+  }
+};
+
+/** Marks the unused places of a StaticTaskList */
+struct No_task {};
+
+/** Type of and access to the task at an index of a StaticTaskList */
+template <int index, class List> 
+struct Static_task_at {
+  typedef Static_task_at<index - 1, typename List::Rest> Next;
+  typedef typename Next::type type;
+  static type& get(List& list) {
+    return Next::get(list.rest());
+  }
+};
+
+template <class List> 
+struct Static_task_at<0, List> {
+  typedef typename List::First type;
+  static type& get(List& list) {
+    return list.first();
+  }
+};
+
+/**
+ * Static task list.
+ * A list of tasks that is fixed at compile time, e.g.:
+ * \code
+ * JOS::StaticTaskList<LedFlash, Ping, Multiplexer> static_tasks;
+ * \endcode
+ * The tasks are members of the list, so they're allocated along with
+ * it rather than with new, and have to be default constructible. 
+ * Their run methods are called directly, so the compiler can inline 
+ * them. For that, run() and any suspended() they override have to be
+ * public. A task that completes stays where it is, but isn't run 
+ * anymore. Successors aren't started. Use get<index>() to get at the
+ * tasks.
+ */
+template <class T1, class T2 = No_task, class T3 = No_task, 
+    class T4 = No_task, class T5 = No_task, class T6 = No_task, 
+    class T7 = No_task, class T8 = No_task>
+struct StaticTaskList {
+  typedef T1 First;
+  typedef StaticTaskList<T2, T3, T4, T5, T6, T7, T8> Rest;
+  StaticTaskList(): _done(false) {}
+  void run() {
+    // Read the clock once per pass, as the task list does
+    run(JOS::now());
+  }
+  void run(const Tick now) {
+    if (!_done) 
+      _done = Static_dispatch::run(_first, now);
+    _rest.run(now);
+  }
+  template <int index> 
+  typename Static_task_at<index, StaticTaskList>::type& get() {
+    return Static_task_at<index, StaticTaskList>::get(*this);
+  }
+  T1& first() {
+    return _first;
+  }
+  Rest& rest() {
+    return _rest;
+  }
+private:
+  T1 _first;
+  Rest _rest;
+  boolean _done;
+};
+
+template <>
+struct StaticTaskList<No_task, No_task, No_task, No_task, 
+    No_task, No_task, No_task, No_task> {
+  void run(const Tick now) {}
 };
 
+/**
+ * \name Coroutine macros
+ * Write the run method of a task as straight line code rather than as
+ * a switch on _run_state. Put JOS_BEGIN at the start and JOS_END at 
+ * the end of the method. Every JOS_YIELD and JOS_AWAIT... returns to
+ * the task list and continues after it at the next execution. As 
+ * with protothreads, local variables don't survive that, so keep 
+ * state in members and don't put two of them on one line. The state
+ * is kept in _run_state, so the method can't be much longer than 250 
+ * lines. When the end is reached, the task is complete.
+ */
+//@{
+#define JOS_BEGIN \
+  enum { jos_begin = __LINE__ }; \
+  switch (_run_state) { \
+    case 0:
+#define JOS_LINE (__LINE__ - jos_begin)
+/** Return to the task list and continue here at the next execution */
+#define JOS_YIELD() \
+      _run_state = JOS_LINE; \
+      return false; \
+    case JOS_LINE + 1:
+/** Rest for a number of microseconds and continue */
+#define JOS_AWAIT_DELAY(microsecs) \
+      rest(microsecs); \
+      JOS_YIELD()
+/** Wait for a signal of the event and continue */
+#define JOS_AWAIT_EVENT(event) \
+      wait(event); \
+      JOS_YIELD()
+/** Continue when the condition holds, checking it at every execution */
+#define JOS_AWAIT(condition) \
+      _run_state = JOS_LINE; \
+    case JOS_LINE + 1: \
+      if (!(condition)) { \
+        _run_state = JOS_LINE; \
+        return false; \
+      }
+#define JOS_END \
+  } \
+  return true;
+//@}
+
 struct TaskList {
-  TaskList(): _size(0), _list_size(4) { 
-    // Create a default list with space for 4 tasks
-    _list = (Task**)malloc(_list_size * sizeof(Task*)); 
-    if (_list == NULL) {
-      panic();
+  TaskList(): _size(0), _ready_count(0), _resting(0), _events(0),
+      _signalled(false),
+#if IDLE_SLEEP != 0
+      _idle_handler(idle_sleep) { 
+#else
+      _idle_handler(0) { 
+#endif
+    for (int i = 0; i < PRIORITY_LEVELS; ++i) {
+      _ready[i] = 0;
+      _ready_tail[i] = 0;
+      _starved[i] = 0;
     }
+#if TASK_WATCHDOG != 0
+    _watching = false;
+    _window = 0;
+    _kicked = 0;
+#endif
+#if TASK_TRACE != 0
+    _trace_next = 0;
+    _trace_count = 0;
+    _trace_paused = false;
+#endif
 #if PANIC_REBOOT != 0
     wdt_disable();
 #endif
@@ -141,12 +753,83 @@ struct TaskList {
   void add(Task* task);
   int count() const;
   void run();
+  // Set the handler called when all tasks are resting. Zero disables it.
+  void set_idle_handler(Idle_handler handler) {
+    _idle_handler = handler;
+  }
+#if TASK_PROFILING != 0
+  // Print a table of the execution statistics of all tasks
+  void print_stats(Output_text& out) const;
+#endif
+#if TASK_WATCHDOG != 0
+  // Start the watchdog, which is kicked from then on for as long as 
+  // every task that is ready to run gets a turn within half its 
+  // timeout. Only start it for the list that runs all others.
+  void start_watchdog();
+  // Task that is running, in whichever list
+  static Task* current() {
+    return _current;
+  }
+#endif
+#if TASK_TRACE != 0
+  // Task that writes the trace to the stream and completes, e.g.
+  // tasks.add(tasks.dump_trace(serial)). Recording pauses meanwhile. 
+  // Every record is written in one go, as a chunk of 10 bytes starting
+  // with 0xFF, after a header chunk starting with 0xFE. Text written 
+  // to the stream in between can be told apart and skipped, as long 
+  // as it's 7 bit. tools/jos_trace.py turns the dump into a timeline.
+  Task* dump_trace(Output_stream& out);
+#endif
   friend class Task;
+#if TASK_TRACE != 0
+  friend class Trace_dump;
+#endif
 private:
   int _size;
-  int _list_size;
-  Task** _list;
-  void run_task(int item);
+  int _ready_count;
+  // Runnable tasks for each priority level, in order of execution
+  Task* _ready[PRIORITY_LEVELS];
+  Task* _ready_tail[PRIORITY_LEVELS];
+  // Dispatches since the first task of a level was last given a turn
+  byte _starved[PRIORITY_LEVELS];
+  // Resting tasks, sorted by the time they're due to continue
+  Task* _resting;
+  // Events that tasks are waiting for
+  Event* _events;
+  // Set when one of the events was signalled
+  volatile boolean _signalled;
+  Idle_handler _idle_handler;
+#if TASK_WATCHDOG != 0
+  boolean _watching;
+  // Number of the current watchdog window
+  byte _window;
+  // ticks() of the last kick
+  unsigned long _kicked;
+  static Task* volatile _current;
+  void kick(const unsigned long now);
+#endif
+#if TASK_TRACE != 0
+  // The last dispatches, oldest first from _trace_next when it's full
+  Trace_record _trace[TASK_TRACE];
+  unsigned int _trace_next;
+  unsigned int _trace_count;
+  // Set while the trace is being dumped
+  boolean _trace_paused;
+  void trace(const Task* task, const unsigned long start);
+#endif
+  Task* next_task();
+  void age(const int served);
+  void run_task(Task* task);
+  void append(Task* task);
+  void detach(Task* task);
+  void enqueue(Task* task);
+  void wake(const Tick now);
+  void park(Task* task);
+  void release();
+  void idle();
+#if TASK_PROFILING != 0
+  static void print_stats(Output_text& out, const Task* task);
+#endif
 };
 
 /* Global task list */
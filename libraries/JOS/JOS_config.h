@@ -1,5 +1,5 @@
 // JOS configuration
-// Override these values in your sketch before including 
+// Override these values in your sketch before including
 // JOS.h and define __JOS_CONFIG_H__ to override these
 // values.
 
@@ -14,5 +14,37 @@
 #endif
 // Reboot on panic. Requires a bootloader that can handle dogs!
 #define PANIC_REBOOT 0
+// Put the processor in idle sleep when all tasks are resting. Any
+// interrupt wakes it up again.
+#define IDLE_SLEEP 0
+// Number of task priority levels (at least 2)
+#define PRIORITY_LEVELS 4
+// Number of dispatches a runnable task may be passed over by tasks of
+// a higher priority before it is promoted to the next level
+#define PRIORITY_AGING 8
+// Keep execution statistics for each task
+#define TASK_PROFILING 0
+// Count the runs of each task that take longer than its budget
+#define TASK_BUDGET 0
+// Have the task list kick the watchdog as long as all of its tasks
+// make progress. When the watchdog fires, the task that stalled the
+// list is reported and we panic. Needs a watchdog interrupt.
+#define TASK_WATCHDOG 0
+// Timeout of the watchdog, as one of the WDTO_ values of avr/wdt.h
+#define WATCHDOG_TIMEOUT WDTO_1S
+// Number of dispatches a task list keeps in its trace, 0 for no trace.
+// A power of 2. Each takes 9 bytes of RAM.
+#define TASK_TRACE 0
+// Number of blocks of 8, 16, 32 and 64 bytes in the slabs that
+// operator new serves small objects from. Each slab takes its number
+// of blocks times their size of RAM. Set them all to 0 to have all
+// objects allocated with malloc.
+#define SLAB_BLOCKS_8 0
+#define SLAB_BLOCKS_16 0
+#define SLAB_BLOCKS_32 0
+#define SLAB_BLOCKS_64 0
+// Keep track of the bytes allocated on the heap and paint the stack
+// at startup, for memory_stats() to report
+#define MEMORY_STATS 0
 
 #endif
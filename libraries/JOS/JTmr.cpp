@@ -0,0 +1,158 @@
+/*
+  JTmr.cpp - Software timers for JOS
+  Copyright (c) 2010 Jaap Versteegh.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "JTmr.h"
+
+namespace JOS {
+
+boolean Timers::start(Timer& timer, const unsigned long delay,
+    const unsigned long period)
+{
+  // The service rests until the first timer is due, so it has to know
+  // when that one moves, either way
+  boolean first = timer.armed() && timer._index == 0;
+  if (timer.armed()) {
+    remove(timer._index);
+  }
+  else if (_count >= _capacity) {
+    return false;
+  }
+  timer._due = now() + micros_to_ticks(delay);
+  timer._period = micros_to_ticks(period);
+  // A period under one tick is still periodic
+  if (period != 0 && timer._period == 0) {
+    timer._period = 1;
+  }
+  push(&timer);
+  if (first || timer._index == 0) {
+    reschedule();
+  }
+  return true;
+}
+
+void Timers::cancel(Timer& timer)
+{
+  if (!timer.armed())
+    return;
+  byte index = timer._index;
+  remove(index);
+  if (index == 0) {
+    reschedule();
+  }
+}
+
+boolean Timers::run()
+{
+  Tick now = JOS::now();
+  // The heap is ordered on due time, so we're done at the first timer
+  // that isn't due
+  while (_count != 0 && _heap[0]->_due <= now) {
+    Timer* timer = _heap[0];
+    if (timer->_period != 0) {
+      // Put it back before calling it, so the callback may cancel or
+      // rearm it
+      timer->_due += timer->_period;
+      if (now > timer->_due) {
+        // Skip the periods we missed rather than calling it again and
+        // again to catch up, keeping the timer in phase. A period that
+        // starts right now is on time, as with PeriodicTask.
+        Tick late = now - timer->_due;
+        if (late > 0x7FFFFFFF) {
+          // Way behind: start over rather than dividing 64 bit numbers
+          timer->_due = now + timer->_period;
+        }
+        else {
+          unsigned long missed = 
+              ((unsigned long)late - 1) / timer->_period + 1;
+          timer->_due += (Tick)missed * timer->_period;
+        }
+      }
+      sift_down(0);
+    }
+    else {
+      remove(0);
+    }
+    timer->_function(timer->_context);
+  }
+  reschedule();
+  return false;
+}
+
+void Timers::push(Timer* timer)
+{
+  place(timer, _count++);
+  sift_up(timer->_index);
+}
+
+void Timers::remove(const byte index)
+{
+  _heap[index]->_index = Timer::unarmed;
+  Timer* last = _heap[--_count];
+  if (index < _count) {
+    // Fill the hole with the last timer and restore the heap order
+    place(last, index);
+    sift_up(index);
+    sift_down(last->_index);
+  }
+}
+
+void Timers::sift_up(byte index)
+{
+  while (index > 0) {
+    byte parent = (index - 1) / 2;
+    if (!earlier(index, parent))
+      break;
+    Timer* timer = _heap[index];
+    place(_heap[parent], index);
+    place(timer, parent);
+    index = parent;
+  }
+}
+
+void Timers::sift_down(byte index)
+{
+  while (true) {
+    // Index of the first child; int, as it may overflow a byte
+    int child = 2 * index + 1;
+    if (child >= _count)
+      break;
+    if (child + 1 < _count && earlier(child + 1, child)) {
+      ++child;
+    }
+    if (!earlier(child, index))
+      break;
+    Timer* timer = _heap[index];
+    place(_heap[child], index);
+    place(timer, child);
+    index = child;
+  }
+}
+
+void Timers::reschedule()
+{
+  if (_count != 0) {
+    rest_until(_heap[0]->_due);
+  }
+  else {
+    // Nothing to do until a timer is started, which reschedules us
+    rest_until(~(Tick)0);
+  }
+}
+
+}  // namespace JOS
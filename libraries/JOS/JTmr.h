@@ -0,0 +1,123 @@
+/*
+  JTmr.h - Software timers for JOS
+  Copyright (c) 2010 Jaap Versteegh.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * \file
+ * Software timers: many one shot and periodic callbacks run by a
+ * single task.
+ */
+
+#ifndef __JTMR_H__
+#define __JTMR_H__
+
+#include "JOS.h"
+
+namespace JOS {
+
+/** Function called when a timer expires */
+typedef void (*Timer_function)(void* context);
+
+/**
+ * Timer.
+ * A callback with its context and the tick it's due. It's a lot
+ * smaller than a task and has no vtable, so it suits the many small
+ * timeouts of e.g. blinking leds, keep alives and retransmissions. The
+ * timer isn't copied by the timer service, so it has to stay around
+ * while it's armed.
+ */
+struct Timer {
+  Timer(Timer_function function, void* context = 0): _function(function),
+      _context(context), _due(0), _period(0), _index(unarmed) {}
+  boolean armed() const {
+    return _index != unarmed;
+  }
+  // Tick at which the timer expires next
+  Tick due() const {
+    return _due;
+  }
+  // Period in ticks
+  unsigned long period() const {
+    return _period;
+  }
+  friend class Timers;
+private:
+  static const byte unarmed = 0xFF;
+  Timer_function _function;
+  void* _context;
+  Tick _due;
+  // Zero for a one shot timer
+  unsigned long _period;
+  // Position in the heap of the timer service
+  byte _index;
+};
+
+/**
+ * Timer service.
+ * Task that calls the callbacks of its timers when they expire. The
+ * armed timers are kept in a binary heap on their due time, so arming
+ * and cancelling a timer takes O(log n) and the task rests until the
+ * first one is due. Periodic timers are rescheduled against their
+ * previous due time, so they don't drift. Use Timer_service to get one
+ * with room for its timers.
+ */
+struct Timers: public Task {
+  Timers(Timer** heap, const byte capacity): Task(), _heap(heap),
+      _capacity(capacity), _count(0) {}
+  // Arm the timer to expire after delay microseconds and then every
+  // period microseconds, if that isn't zero. Rearms a timer that is
+  // armed already. Returns false when there is no room for it.
+  boolean start(Timer& timer, const unsigned long delay,
+      const unsigned long period = 0);
+  // Disarm the timer. Nothing happens when it isn't armed.
+  void cancel(Timer& timer);
+  // Number of armed timers
+  byte count() const {
+    return _count;
+  }
+protected:
+  virtual boolean run();
+private:
+  Timer** _heap;
+  byte _capacity;
+  byte _count;
+  boolean earlier(const byte i, const byte j) const {
+    return _heap[i]->_due < _heap[j]->_due;
+  }
+  void place(Timer* timer, const byte index) {
+    _heap[index] = timer;
+    timer->_index = index;
+  }
+  void push(Timer* timer);
+  void remove(const byte index);
+  void sift_up(byte index);
+  void sift_down(byte index);
+  void reschedule();
+};
+
+/** Timer service with room for a fixed number of timers */
+template <byte capacity> struct Timer_service: public Timers {
+  Timer_service(): Timers(_slots, capacity) {}
+private:
+  Timer* _slots[capacity];
+};
+
+}  // namespace JOS
+
+
+#endif
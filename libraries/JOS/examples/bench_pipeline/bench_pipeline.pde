@@ -0,0 +1,90 @@
+#define DEBUG
+#include <JOS.h>
+#include <JCls.h>
+#include <JFlt.h>
+
+// Filters, splits and checks NMEA sentences, once through a pipeline
+// of filters and once a byte at a time through an EscapeFilter and a
+// String, as the multiplexer does, and reports the cycles per byte
+// each takes.
+
+typedef JOS::Unescape<'\\', JOS::Line_splitter<
+    JOS::Nmea_checksum<JOS::Line_sink<82> > > > Nmea_pipeline;
+
+static const char sentence[] = "$GPGLL,4916.45,N,12311.12,W,225444,A,*1D\r\n";
+static const int repeats = 20;
+
+// Output that only counts what is written to it
+struct Counter: JOS::Output_stream {
+  unsigned long count;
+  Counter(): JOS::Output_stream(), count(0) {}
+  virtual int writeable() const {
+    return 0x100;
+  }
+  virtual boolean write(const byte* data, int size) {
+    count += size;
+    return true;
+  }
+};
+
+byte checksum(JOS::String& line)
+{
+  byte sum = 0;
+  const char* c = line.c_str() + 1;
+  while (*c != 0 && *c != '*') {
+    sum ^= *c++;
+  }
+  return sum;
+}
+
+void report(const char* what, unsigned long duration, int bytes, 
+    unsigned long written)
+{
+  D_JOS(what);
+  D_JOS("Bytes written:");
+  D_JOS(written);
+  D_JOS("Cycles per byte:");
+  D_JOS(duration * (F_CPU / 1000000) / bytes);
+}
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting pipeline benchmark");
+  JOS::String input;
+  for (int i = 0; i < repeats; ++i) {
+    input += sentence;
+  }
+
+  Counter piped;
+  Nmea_pipeline pipeline(piped);
+  unsigned long start = micros();
+  JOS::feed(input, pipeline);
+  report("Pipeline", micros() - start, input.len(), piped.count);
+
+  input.rewind();
+  Counter streamed;
+  JOS::EscapeFilter<'\\'> filter(&input);
+  JOS::Input_stream& stream = filter;
+  JOS::String line;
+  byte c;
+  start = micros();
+  while (stream.read(&c, 1)) {
+    if (c == '\r' || c == '\n') {
+      if (line.len() != 0 && checksum(line) != 0) {
+        line.rewind();
+        streamed << line;
+      }
+      line.clear();
+    }
+    else {
+      line.write(&c, 1);
+    }
+  }
+  report("Virtual streams", micros() - start, input.len(), streamed.count);
+  D_JOS("Done");
+}
+
+void loop()
+{
+}
@@ -0,0 +1,76 @@
+#define DEBUG
+#include <JOS.h>
+
+// Measures the worst case latency of a task at each priority level,
+// i.e. how late it gets to run after it was due. A number of busy
+// tasks that never rest, like the serial tasks, load the scheduler at
+// the highest and the normal level.
+
+static const unsigned long period = 10000;
+static const unsigned long duration = 10000000;
+
+struct Busy: JOS::Task {
+  Busy(byte priority): JOS::Task() {
+    set_priority(priority);
+  }
+  virtual boolean run() {
+    delayMicroseconds(100);
+    return false;
+  }
+};
+
+struct Probe: JOS::Task {
+  unsigned long due;
+  unsigned long worst;
+  Probe(byte priority): JOS::Task(), due(0), worst(0) {
+    set_priority(priority);
+  }
+  virtual boolean run() {
+    unsigned long now = micros();
+    if (due != 0 && now - due > worst) {
+      worst = now - due;
+    }
+    due = now + period;
+    rest(period);
+    return false;
+  }
+};
+
+Probe* probes[PRIORITY_LEVELS];
+
+struct Report: JOS::Task {
+  virtual boolean run() {
+    if (_run_state == 0) {
+      rest(duration);
+      return false;
+    }
+    D_JOS("Worst case latency in microseconds per level:");
+    for (int i = 0; i < PRIORITY_LEVELS; ++i) {
+      D_JOS(i);
+      D_JOS(probes[i]->worst);
+    }
+    return true;
+  }
+};
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting priority latency benchmark");
+  for (int i = 0; i < 4; ++i) {
+    JOS::tasks.add(new Busy(JOS::Task::priority_high));
+    JOS::tasks.add(new Busy(JOS::Task::priority_normal));
+  }
+  for (int i = 0; i < PRIORITY_LEVELS; ++i) {
+    probes[i] = new Probe(i);
+    JOS::tasks.add(probes[i]);
+  }
+  Report* report = new Report();
+  report->boost_priority();
+  JOS::tasks.add(report);
+}
+
+void loop()
+{
+  JOS::tasks.run();
+}
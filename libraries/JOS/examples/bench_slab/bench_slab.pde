@@ -0,0 +1,76 @@
+#define DEBUG
+#include <JOS.h>
+#include <JCls.h>
+#include <JMem.h>
+
+// Allocates and frees objects of mixed sizes at random, as tasks,
+// sockets and strings come and go, once through the slabs that
+// operator new uses and once with plain malloc. Reports how far the
+// heap grew for each: the more it fragments, the further it grows.
+// Give the slabs some blocks in JOS_config.h first, e.g. 16 of each.
+
+extern char* __brkval;
+extern char __heap_start;
+
+static const int slots = 24;
+static const long steps = 20000;
+
+void* objects[slots];
+
+char* heap_top()
+{
+  return __brkval != 0 ? __brkval : &__heap_start;
+}
+
+size_t random_size()
+{
+  // Mostly small objects, sometimes a larger buffer
+  if (random(8) == 0)
+    return random(65, 160);
+  return random(4, 65);
+}
+
+void stress(boolean slabs)
+{
+  randomSeed(1);
+  char* start = heap_top();
+  for (long i = 0; i < steps; ++i) {
+    int slot = random(slots);
+    if (objects[slot] != 0) {
+      if (slabs)
+        JOS::release(objects[slot]);
+      else
+        free(objects[slot]);
+      objects[slot] = 0;
+    }
+    else {
+      size_t size = random_size();
+      objects[slot] = slabs ? JOS::allocate(size) : malloc(size);
+      J_ASSERT(objects[slot] != 0, "Out of memory");
+    }
+  }
+  D_JOS(slabs ? "Slabs, heap grew by:" : "Malloc, heap grew by:");
+  D_JOS(heap_top() - start);
+  for (int slot = 0; slot < slots; ++slot) {
+    if (slabs)
+      JOS::release(objects[slot]);
+    else
+      free(objects[slot]);
+    objects[slot] = 0;
+  }
+}
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting slab benchmark");
+  // Each run frees all it allocated, which gives the heap back to the
+  // next one
+  stress(false);
+  stress(true);
+  D_JOS("Done");
+}
+
+void loop()
+{
+}
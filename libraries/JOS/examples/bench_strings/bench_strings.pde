@@ -0,0 +1,59 @@
+#define DEBUG
+#include <JOS.h>
+#include <JCls.h>
+
+// Appends NMEA sentences to a string one character at a time, as the
+// multiplexer does when they come in, and reports the time per
+// sentence for a string on the heap, one with room for a sentence in
+// itself and a fixed string.
+
+static const char sentence[] =
+  "$GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W*6A";
+static const int sentences = 200;
+
+template <class S>
+void bench(S& s, const char* what)
+{
+  unsigned long start = micros();
+  for (int i = 0; i < sentences; ++i) {
+    s.clear();
+    for (const char* c = sentence; *c != 0; ++c) {
+      s.write((const byte*)c, 1);
+    }
+  }
+  unsigned long duration = micros() - start;
+  J_ASSERT(s == sentence, "Sentence garbled");
+  D_JOS(what);
+  D_JOS("Microseconds per sentence:");
+  D_JOS(duration / sentences);
+}
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting string benchmark");
+  {
+    // A fresh string every time, which has to grow each time
+    unsigned long start = micros();
+    for (int i = 0; i < sentences; ++i) {
+      JOS::String s;
+      for (const char* c = sentence; *c != 0; ++c) {
+        s.write((const byte*)c, 1);
+      }
+    }
+    D_JOS("Fresh heap string");
+    D_JOS("Microseconds per sentence:");
+    D_JOS((micros() - start) / sentences);
+  }
+  JOS::String heap_string;
+  bench(heap_string, "Reused heap string");
+  JOS::Small_string<82> small_string;
+  bench(small_string, "Small string");
+  JOS::Fixed_string<82> fixed_string;
+  bench(fixed_string, "Fixed string");
+  D_JOS("Done");
+}
+
+void loop()
+{
+}
@@ -0,0 +1,93 @@
+#define DEBUG
+#include <JOS.h>
+
+// Measures the overhead of a pass through the task list when
+// all tasks are resting, which is what most tasks do most of the
+// time. 1000 tasks won't fit in the RAM of an arduino, so we stop
+// at 100. Then compares dispatching 8 busy tasks through a task 
+// list with a static task list.
+
+struct Sleeper: JOS::Task {
+  Sleeper(): JOS::Task() {}
+  virtual boolean run() {
+    rest(60000000); // Rest for a minute: won't wake up during the test
+    return false;
+  }
+};
+
+// Task that does next to nothing, so we measure the dispatch
+struct Counter: JOS::Task {
+  unsigned long count;
+  Counter(): JOS::Task(), count(0) {}
+  boolean run() {
+    ++count;
+    return false;
+  }
+};
+
+static const int passes = 1000;
+
+void add_tasks(int count)
+{
+  for (int i = 0; i < count; ++i) {
+    JOS::tasks.add(new Sleeper());
+  }
+  // Have all new tasks run once so they start resting
+  JOS::tasks.run();
+}
+
+void bench()
+{
+  unsigned long start = micros();
+  for (int i = 0; i < passes; ++i) {
+    JOS::tasks.run();
+  }
+  unsigned long elapsed = micros() - start;
+  D_JOS("Tasks:");
+  D_JOS(JOS::tasks.count());
+  D_JOS("Microseconds per pass:");
+  D_JOS(elapsed / passes);
+}
+
+void bench_dispatch()
+{
+  JOS::TaskList dynamic_tasks;
+  for (int i = 0; i < 8; ++i) {
+    dynamic_tasks.add(new Counter());
+  }
+  JOS::StaticTaskList<Counter, Counter, Counter, Counter, 
+      Counter, Counter, Counter, Counter> static_tasks;
+
+  unsigned long start = micros();
+  for (int i = 0; i < passes; ++i) {
+    dynamic_tasks.run();
+  }
+  unsigned long elapsed = micros() - start;
+  D_JOS("Task list, cycles per dispatch:");
+  D_JOS(elapsed * clockCyclesPerMicrosecond() / passes / 8);
+
+  start = micros();
+  for (int i = 0; i < passes; ++i) {
+    static_tasks.run();
+  }
+  elapsed = micros() - start;
+  D_JOS("Static task list, cycles per dispatch:");
+  D_JOS(elapsed * clockCyclesPerMicrosecond() / passes / 8);
+}
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting task dispatch benchmark");
+  add_tasks(10);
+  bench();
+  add_tasks(90);
+  bench();
+  bench_dispatch();
+  D_JOS("Done");
+}
+
+void loop()
+{
+  JOS::tasks.run();
+}
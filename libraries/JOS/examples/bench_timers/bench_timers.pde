@@ -0,0 +1,82 @@
+#define DEBUG
+#include <JOS.h>
+#include <JTmr.h>
+
+// Compares a timer service running 32 periodic timers with 32 tasks
+// doing the same: the RAM they take and the time a pass through the
+// task list takes while they run.
+
+extern char* __brkval;
+extern char __heap_start;
+
+static const int count = 32;
+static const unsigned long duration = 2000000;
+
+unsigned long expired = 0;
+
+void on_timer(void* context)
+{
+  ++expired;
+}
+
+struct Ticker: JOS::Task {
+  unsigned long period;
+  Ticker(unsigned long p): JOS::Task(), period(p) {}
+  virtual boolean run() {
+    on_timer(this);
+    rest(period);
+    return false;
+  }
+};
+
+char* heap_top()
+{
+  return __brkval != 0 ? __brkval : &__heap_start;
+}
+
+void bench(JOS::TaskList& list, const char* what, int bytes)
+{
+  unsigned long passes = 0;
+  expired = 0;
+  unsigned long start = micros();
+  while (micros() - start < duration) {
+    list.run();
+    ++passes;
+  }
+  D_JOS(what);
+  D_JOS("Bytes:");
+  D_JOS(bytes);
+  D_JOS("Expired:");
+  D_JOS(expired);
+  D_JOS("Microseconds per pass:");
+  D_JOS(duration / passes);
+}
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting timer benchmark");
+
+  char* top = heap_top();
+  JOS::TaskList task_list;
+  for (int i = 0; i < count; ++i) {
+    task_list.add(new Ticker(10000 + 1000 * i));
+  }
+  bench(task_list, "Tasks", heap_top() - top);
+
+  top = heap_top();
+  JOS::TaskList timer_list;
+  JOS::Timer_service<count>* timers = new JOS::Timer_service<count>();
+  JOS::Timer* timer_set[count];
+  for (int i = 0; i < count; ++i) {
+    timer_set[i] = new JOS::Timer(on_timer);
+    timers->start(*timer_set[i], 0, 10000 + 1000 * i);
+  }
+  timer_list.add(timers);
+  bench(timer_list, "Timers", heap_top() - top);
+  D_JOS("Done");
+}
+
+void loop()
+{
+}
@@ -0,0 +1,65 @@
+#define DEBUG
+#include <JOS.h>
+
+// Chains tasks into a graph: a start up task fans out to three ports
+// that start up in parallel, and a publisher that continues once all
+// of them have completed.
+
+static const int port_count = 3;
+static int ports_started = 0;
+
+struct Startup: JOS::Task {
+  virtual boolean run() {
+    D_JOS("Starting up");
+    return true;
+  }
+};
+
+struct Port: JOS::Task {
+  int steps;
+  Port(int s): JOS::Task(), steps(s) {}
+  virtual boolean run() {
+    // Take a number of rests to start up, so the ports finish in
+    // a different order than they started
+    if (--steps > 0) {
+      rest(1000 * steps);
+      return false;
+    }
+    ++ports_started;
+    return true;
+  }
+};
+
+struct Publisher: JOS::Task {
+  int completed;
+  Publisher(): JOS::Task(), completed(0) {}
+  virtual boolean run() {
+    J_ASSERT(completed == port_count, "Not all predecessors completed");
+    J_ASSERT(ports_started == port_count, "Started before the ports");
+    D_JOS("Tests successful!");
+    return true;
+  }
+protected:
+  virtual void prev_completed(JOS::Task* prev_task) {
+    ++completed;
+  }
+};
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting tests!");
+  Startup* startup = new Startup();
+  Publisher* publisher = new Publisher();
+  for (int i = 0; i < port_count; ++i) {
+    Port* port = new Port(port_count - i);
+    port->set_predecessor(startup);
+    publisher->set_predecessor(port);
+  }
+  JOS::tasks.add(startup);
+}
+
+void loop()
+{
+  JOS::tasks.run();
+}
@@ -0,0 +1,113 @@
+#define DEBUG
+#include <JOS.h>
+
+// Checks the tick clock of JOS. It's started from a static constructor,
+// after which the core init() takes timer 2 for PWM, and the task list
+// has to take it back. The clock is then fast forwarded to just before
+// its overflow count wraps, at 2^40 ticks, so the low 32 bits wrap and
+// the epoch goes up within a second. Meanwhile the clock should keep
+// counting up, a task resting across the wrap should wake on time and
+// a task resting for 30 days shouldn't wake at all.
+
+// Start the clock before init() runs, as resting from a static task
+// would do
+struct Early_start {
+  Early_start() {
+    JOS::start_clock();
+  }
+} early_start;
+
+// Overflows left before the wrap: 256 overflows of 1 ms at 16 MHz
+static const unsigned long fast_forward = 0xFFFFFF00;
+static const unsigned long sleep_time = 1000000;
+
+struct Monotonic: JOS::Task {
+  JOS::Tick last;
+  unsigned long ticks_last;
+  boolean wrapped;
+  Monotonic(): JOS::Task(), last(0), ticks_last(0), wrapped(false) {}
+  virtual boolean run() {
+    JOS::Tick now = JOS::now();
+    unsigned long ticks = JOS::ticks();
+    if (last != 0) {
+      J_ASSERT(now >= last, "Clock went back");
+      // The cheap clock wraps, but differences still come out right
+      J_ASSERT(ticks - ticks_last < 0x80000000, "Cheap clock went back");
+      if (ticks < ticks_last)
+        wrapped = true;
+    }
+    last = now;
+    ticks_last = ticks;
+    return false;
+  }
+};
+
+// Set by the sleeper, which is gone by the time we report
+static boolean woke = false;
+
+struct Sleeper: JOS::Task {
+  unsigned long started;
+  Sleeper(): JOS::Task(), started(0) {}
+  virtual boolean run() {
+    if (_run_state == 0) {
+      J_ASSERT(JOS::tick_epoch == 0, "Wrapped before resting");
+      started = micros();
+      rest(sleep_time);
+      return false;
+    }
+    unsigned long slept = micros() - started;
+    J_ASSERT(JOS::tick_epoch == 1, "Woke before the wrap");
+    J_ASSERT(slept >= sleep_time && slept < sleep_time + 10000, 
+        "Woke at the wrong time");
+    woke = true;
+    return true;
+  }
+};
+
+struct Long_sleeper: JOS::Task {
+  virtual boolean run() {
+    if (_run_state == 0) {
+      rest_until(JOS::now() + JOS::seconds_to_ticks(30UL * 86400));
+      return false;
+    }
+    J_ASSERT(false, "Woke 30 days early");
+    return true;
+  }
+};
+
+Monotonic* monotonic;
+
+struct Report: JOS::Task {
+  virtual boolean run() {
+    if (_run_state == 0) {
+      rest(2 * sleep_time);
+      return false;
+    }
+    J_ASSERT(monotonic->wrapped, "Cheap clock didn't wrap");
+    J_ASSERT(woke, "Sleeper didn't wake");
+    D_JOS("Tests successful!");
+    return true;
+  }
+};
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting tests!");
+  J_ASSERT(TCCR2A != 0, "Timer 2 wasn't taken for PWM by init()");
+  uint8_t sreg = SREG;
+  cli();
+  JOS::tick_overflows = fast_forward;
+  SREG = sreg;
+  monotonic = new Monotonic();
+  JOS::tasks.add(monotonic);
+  JOS::tasks.add(new Sleeper());
+  JOS::tasks.add(new Long_sleeper());
+  JOS::tasks.add(new Report());
+}
+
+void loop()
+{
+  JOS::tasks.run();
+  J_ASSERT(TCCR2A == 0, "Timer 2 not back in normal mode");
+}
@@ -0,0 +1,130 @@
+#define DEBUG
+#include <JOS.h>
+#include <JCls.h>
+#include <JFlt.h>
+
+// Encodes random frames with SLIP, COBS and HDLC style escapes, decodes
+// them again and checks they come back the same, then reports the
+// cycles per byte of encoding and decoding. Each is done once more over
+// an output that takes no more than 127 bytes at a time, less than a
+// COBS block.
+
+typedef JOS::Escape_encoder<0x7E, 0x7D, 0x20, JOS::Stream_sink> Hdlc_encoder;
+typedef JOS::Escape_decoder<0x7E, 0x7D, 0x20, JOS::Frame_sink> Hdlc_decoder;
+
+static const int frames = 50;
+static const int max_size = 300;
+
+static byte frame[max_size];
+static byte decoded[max_size];
+static unsigned long seed = 1;
+
+// Random bytes, with plenty of zeros and special characters
+byte random_byte(const byte kind)
+{
+  seed = seed * 1103515245 + 12345;
+  byte b = seed >> 16;
+  switch (kind) {
+    case 1:
+      return b & 0x80 ? 0 : b;
+    case 2:
+      return b & 0x01 ? JOS::slip_end : JOS::slip_esc;
+    case 3:
+      return b & 0x01 ? 0x7E : 0x7D;
+    default:
+      return b;
+  }
+}
+
+// Output that takes no more than a few bytes at a time, as a serial
+// port does
+struct Bounded_stream: public JOS::Output_stream {
+  Bounded_stream(JOS::Output_stream& output, const int bound):
+      _output(output), _bound(bound) {}
+  virtual int writeable() const {
+    int size = _output.writeable();
+    return size < _bound ? size : _bound;
+  }
+  using JOS::Output_stream::write;
+  virtual boolean write(const byte* data, int size) {
+    return size <= writeable() && _output.write(data, size);
+  }
+private:
+  JOS::Output_stream& _output;
+  int _bound;
+};
+
+// Empty frames only come through encodings that can tell them from the
+// delimiters between frames
+template <class Encoder, class Decoder>
+void round_trip(const char* name, const int bound, 
+    const boolean empty_frames)
+{
+  D_JOS(name);
+  unsigned long encoding = 0;
+  unsigned long decoding = 0;
+  unsigned long bytes = 0;
+  for (int i = 0; i < frames; ++i) {
+    int size = (random_byte(0) << 8 | random_byte(0)) % max_size;
+    for (int j = 0; j < size; ++j) {
+      frame[j] = random_byte(i % 4);
+    }
+    JOS::String encoded;
+    Bounded_stream output(encoded, bound);
+    JOS::Encoding_stream<Encoder> encoder(output);
+    unsigned long start = micros();
+    int written = 0;
+    int part;
+    while (written < size && (part = encoder.writeable()) > 0) {
+      if (part > size - written)
+        part = size - written;
+      if (!encoder.write(frame + written, part))
+        break;
+      written += part;
+    }
+    boolean ended = encoder.end_frame() && encoder.sent();
+    encoding += micros() - start;
+    J_ASSERT(written == size && ended, "Encoder stalled");
+
+    JOS::Decoding_stream<Decoder> decoder(encoded);
+    start = micros();
+    int length = 0;
+    int read;
+    while ((read = decoder.read(decoded + length, max_size - length)) != 0) {
+      length += read;
+    }
+    decoding += micros() - start;
+    if (size != 0 || empty_frames) {
+      J_ASSERT(decoder.frame_ended() && decoder.frame_valid(), 
+          "Frame not decoded");
+    }
+    J_ASSERT(length == size && memcmp(decoded, frame, size) == 0, 
+        "Decoded frame differs");
+    bytes += size;
+  }
+  D_JOS("Encoding cycles per byte:");
+  D_JOS(encoding * (F_CPU / 1000000) / bytes);
+  D_JOS("Decoding cycles per byte:");
+  D_JOS(decoding * (F_CPU / 1000000) / bytes);
+}
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting codec test");
+  round_trip<JOS::Slip_encoder<JOS::Stream_sink>, 
+      JOS::Slip_decoder<JOS::Frame_sink> >("SLIP", 0x7FFF, false);
+  round_trip<JOS::Cobs_encoder<JOS::Stream_sink>, 
+      JOS::Cobs_decoder<JOS::Frame_sink> >("COBS", 0x7FFF, true);
+  round_trip<Hdlc_encoder, Hdlc_decoder>("HDLC", 0x7FFF, false);
+  round_trip<JOS::Slip_encoder<JOS::Stream_sink>, 
+      JOS::Slip_decoder<JOS::Frame_sink> >("SLIP, bounded", 127, false);
+  round_trip<JOS::Cobs_encoder<JOS::Stream_sink>, 
+      JOS::Cobs_decoder<JOS::Frame_sink> >("COBS, bounded", 127, true);
+  round_trip<Hdlc_encoder, Hdlc_decoder>("HDLC, bounded", 127, false);
+  D_JOS("Done");
+}
+
+void loop()
+{
+}
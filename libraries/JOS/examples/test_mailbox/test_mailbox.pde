@@ -0,0 +1,88 @@
+#define DEBUG
+#include <JOS.h>
+#include <JCls.h>
+#include <JMbx.h>
+
+// Passes sentences from a parser task to a formatter task through a
+// mailbox. The sentences are taken from a pool and given back by the
+// formatter, so they're filled once and never copied.
+
+static const char* input = "$GPGLL,1*00\r\n$GPRMC,2*00\r\n$GPVTG,3*00\r\n";
+static const int sentences = 300;
+
+struct Sentence {
+  byte length;
+  char text[82];
+};
+
+JOS::Pool<Sentence, 4> pool;
+JOS::Mailbox<Sentence, 4> mailbox;
+
+struct Parser: JOS::Task {
+  const char* next;
+  Sentence* sentence;
+  int parsed;
+  Parser(): JOS::Task(), next(input), sentence(0), parsed(0) {}
+  virtual boolean run() {
+    if (parsed == sentences)
+      return true;
+    if (sentence == 0) {
+      sentence = pool.take();
+      if (sentence == 0) {
+        // All sentences are on their way: try again later
+        rest(100);
+        return false;
+      }
+      sentence->length = 0;
+    }
+    char c = *next++;
+    if (*next == 0)
+      next = input;
+    if (c == '\n') {
+      sentence->text[sentence->length] = 0;
+      boolean sent = mailbox.send(sentence);
+      J_ASSERT(sent, "Mailbox full");
+      sentence = 0;
+      ++parsed;
+    }
+    else if (c != '\r') {
+      sentence->text[sentence->length++] = c;
+    }
+    return false;
+  }
+};
+
+struct Formatter: JOS::Task {
+  int formatted;
+  Formatter(): JOS::Task(), formatted(0) {}
+  virtual boolean run() {
+    Sentence* sentence;
+    while ((sentence = mailbox.receive()) != 0) {
+      J_ASSERT(sentence->text[0] == '$', "Sentence mixed up");
+      J_ASSERT(sentence->text[3] == "GRV"[formatted % 3],
+          "Sentence out of order");
+      ++formatted;
+      pool.give(sentence);
+    }
+    if (formatted == sentences) {
+      J_ASSERT(pool.available() == 4, "Sentence wasn't given back");
+      D_JOS("Tests successful!");
+      return true;
+    }
+    wait(mailbox.event());
+    return false;
+  }
+};
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting tests!");
+  JOS::tasks.add(new Parser());
+  JOS::tasks.add(new Formatter());
+}
+
+void loop()
+{
+  JOS::tasks.run();
+}
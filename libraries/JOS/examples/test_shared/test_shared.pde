@@ -0,0 +1,78 @@
+#define DEBUG
+#include <JOS.h>
+#include <JCls.h>
+#include <JMbx.h>
+
+// Fans sentences out to two sinks through shared buffers: a log that
+// takes everything at once and an output that only takes a few bytes
+// at a time. Both should end up with every sentence, in order.
+
+static const char* input[] = { "$GPGLL,1*00\r\n", "$GPRMC,2*00\r\n" };
+static const int sentences = 20;
+
+// Output that takes at most 3 bytes at a time
+struct Trickle: JOS::Output_stream {
+  JOS::String text;
+  virtual int writeable() const {
+    return 3;
+  }
+  virtual boolean write(const byte* data, int size) {
+    return text.write(data, size);
+  }
+};
+
+JOS::String log_text;
+Trickle trickle;
+JOS::Static_buffer_sink<4>* log_sink;
+JOS::Static_buffer_sink<4>* trickle_sink;
+
+struct Producer: JOS::Task {
+  int produced;
+  Producer(): JOS::Task(), produced(0) {}
+  virtual boolean run() {
+    if (produced == sentences) {
+      if (log_sink->queued() != 0 || trickle_sink->queued() != 0) {
+        rest(1000);
+        return false;
+      }
+      J_ASSERT(log_text.len() == trickle.text.len(), "Sinks differ");
+      J_ASSERT(log_text.len() == 13 * sentences, "Sentences missing");
+      J_ASSERT(trickle.text.c_str()[13] == '$', "Sentences mixed up");
+      D_JOS("Tests successful!");
+      return true;
+    }
+    if (log_sink->queued() == 4 || trickle_sink->queued() == 4) {
+      // Let the slow sink catch up
+      rest(1000);
+      return false;
+    }
+    JOS::String sentence(input[produced % 2]);
+    JOS::Shared_buffer* buffer = JOS::Shared_buffer::create(sentence);
+    J_ASSERT(buffer != 0, "Out of memory");
+    boolean sent = log_sink->send(buffer) && trickle_sink->send(buffer);
+    J_ASSERT(sent, "Sink full");
+    // The sinks hold on to it as long as they need it
+    buffer->release();
+    ++produced;
+    rest(500);
+    return false;
+  }
+};
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting tests!");
+  // The log never fills up. Give the trickle as long as 3 characters
+  // take at 115200 baud.
+  log_sink = new JOS::Static_buffer_sink<4>(log_text, 1000);
+  trickle_sink = new JOS::Static_buffer_sink<4>(trickle, 30000000 / 115200);
+  JOS::tasks.add(log_sink);
+  JOS::tasks.add(trickle_sink);
+  JOS::tasks.add(new Producer());
+}
+
+void loop()
+{
+  JOS::tasks.run();
+}
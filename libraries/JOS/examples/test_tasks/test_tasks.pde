@@ -0,0 +1,60 @@
+#define DEBUG
+#include <JOS.h>
+
+// Creates and finishes thousands of short lived tasks. The task list
+// shouldn't allocate any memory of its own, so once the first batch
+// has come and gone, the heap shouldn't grow anymore.
+
+extern char* __brkval;
+
+static const long total = 5000;
+static const long warmup = 100;
+
+struct Short_lived: JOS::Task {
+  int runs;
+  Short_lived(): JOS::Task(), runs(0) {}
+  virtual boolean run() {
+    rest(100 * runs);
+    return ++runs > 3;
+  }
+};
+
+struct Spawner: JOS::Task {
+  long spawned;
+  char* heap_top;
+  Spawner(): JOS::Task(), spawned(0), heap_top(0) {}
+  virtual boolean run() {
+    if (spawned < total) {
+      Short_lived* task = new Short_lived();
+      if (spawned & 1) {
+        // Have some of them rest before they're added
+        task->rest(50);
+      }
+      JOS::tasks.add(task);
+      ++spawned;
+      if (spawned == warmup) {
+        heap_top = __brkval;
+      }
+      J_ASSERT(JOS::tasks.count() < 64, "Finished tasks weren't removed");
+      return false;
+    }
+    // Wait for the last ones to finish
+    if (JOS::tasks.count() > 1)
+      return false;
+    J_ASSERT(__brkval == heap_top, "Heap grew while spawning tasks");
+    D_JOS("Tests successful!");
+    return true;
+  }
+};
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting tests!");
+  JOS::tasks.add(new Spawner());
+}
+
+void loop()
+{
+  JOS::tasks.run();
+}
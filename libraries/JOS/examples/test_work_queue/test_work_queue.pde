@@ -0,0 +1,80 @@
+#define DEBUG
+#include <JOS.h>
+
+// Posts numbered work to a bottom half from the timer 1 interrupt, 
+// every 50 us, and checks that every number arrives once and in order.
+// A busy task keeps the bottom half from running now and then, so the
+// queue fills up and posts get turned away as well.
+
+static const unsigned int total = 50000;
+
+JOS::Bottom_half<16> bottom_half;
+
+// Written by the interrupt handler only
+static volatile unsigned int posted = 0;
+static volatile unsigned int rejected = 0;
+// Written by the bottom half only
+static unsigned int expected = 0;
+
+void check(void* context)
+{
+  unsigned int number = (unsigned int)(size_t)context;
+  J_ASSERT(number == expected, "Work lost, repeated or out of order");
+  ++expected;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+  if (posted == total)
+    return;
+  if (bottom_half.post(check, (void*)(size_t)posted)) {
+    ++posted;
+  }
+  else {
+    ++rejected;
+  }
+}
+
+struct Busy: JOS::Task {
+  virtual boolean run() {
+    // Long enough for 40 posts, more than fit in the queue
+    delayMicroseconds(2000);
+    rest(10000);
+    return false;
+  }
+};
+
+struct Report: JOS::Task {
+  virtual boolean run() {
+    if (expected != total) {
+      rest(100000);
+      return false;
+    }
+    TIMSK1 &= ~_BV(OCIE1A);
+    J_ASSERT(posted == total, "Posted more work than was done");
+    J_ASSERT(rejected != 0, "Queue never filled up");
+    D_JOS("Posts rejected on a full queue:");
+    D_JOS(rejected);
+    D_JOS("Tests successful!");
+    return true;
+  }
+};
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting tests!");
+  JOS::tasks.add(&bottom_half);
+  JOS::tasks.add(new Busy());
+  JOS::tasks.add(new Report());
+  // Timer 1 in CTC mode at 2 MHz, interrupting every 100 counts
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12) | _BV(CS11);
+  OCR1A = 99;
+  TIMSK1 |= _BV(OCIE1A);
+}
+
+void loop()
+{
+  JOS::tasks.run();
+}
@@ -42,6 +42,8 @@ static Tx_buffer tx_buffer3;
 { \
   byte data = reg; \
   buf.put(data); \
+  if (buf.event != 0) \
+    buf.event->signal(); \
 }
 
 #define TX_HANDLER(sign, reg, buf) ISR(sign) \
@@ -172,10 +174,17 @@ void SerialBase::set_baud(volatile uint8_t* ubrrh, volatile uint8_t* ubrrl,
 
 int SerialBase::read_data(byte* data, int size)
 {
+  // The data may wrap around the end of the buffer, so it takes up to
+  // two spans
   int i = 0;
-  byte b;
-  while (i < size && _rx_buffer->get(&b)) {
-    data[i++] = b;
+  const byte* span;
+  int spanned;
+  while (i < size && (spanned = _rx_buffer->span(&span)) != 0) {
+    if (spanned > size - i)
+      spanned = size - i;
+    memcpy(data + i, span, spanned);
+    _rx_buffer->consume(spanned);
+    i += spanned;
   }
   return i;
 }
@@ -185,11 +194,16 @@ boolean SerialBase::write_data(const byte* data, int len)
   if (len > writeable_data())
     return false;
   int i = 0;
+  byte* room;
   while (i < len) {
-    if (!_tx_buffer->put(data[i++])) {
-      // Write buffer is full?... shouldn't happen as we checked for the size
-      J_ASSERT(false, "Serial write buffer full");
-    }
+    int size = _tx_buffer->room(&room);
+    // Write buffer is full?... shouldn't happen as we checked for the size
+    J_ASSERT(size != 0, "Serial write buffer full");
+    if (size > len - i)
+      size = len - i;
+    memcpy(room, data + i, size);
+    _tx_buffer->commit(size);
+    i += size;
   }
   return true;
 }
@@ -81,6 +81,33 @@ template<uint8_t bufsize> struct Buffer {
     int l = _head + bufsize - _tail;
     return (uint8_t)l & mask;
   }
+  // Bytes from the tail on that are contiguous in memory
+  uint8_t span(const byte** data) {
+    uint8_t head = _head;
+    uint8_t tail = _tail;
+    *data = buffer + tail;
+    return head >= tail ? head - tail : bufsize - tail;
+  }
+  void consume(uint8_t size) {
+    // Make sure the data is read before its place is given back
+    __asm__ __volatile__ ("" ::: "memory");
+    _tail = (_tail + size) & mask;
+  }
+  // Room from the head on that is contiguous in memory, keeping the
+  // place before the tail free
+  uint8_t room(byte** data) {
+    uint8_t head = _head;
+    uint8_t tail = _tail;
+    *data = buffer + head;
+    if (tail > head)
+      return tail - head - 1;
+    return tail == 0 ? bufsize - head - 1 : bufsize - head;
+  }
+  void commit(uint8_t size) {
+    // Make sure the data is stored before it is published
+    __asm__ __volatile__ ("" ::: "memory");
+    _head = (_head + size) & mask;
+  }
   Buffer(): _head(0), _tail(0) {}
 protected:
   static const uint8_t mask = bufsize - 1;
@@ -93,9 +120,12 @@ protected:
 };
 
 struct Rx_buffer: public Buffer<RX_BUFFER_SIZE> {
+  Rx_buffer(): Buffer<RX_BUFFER_SIZE>(), event(0) {}
   void flush() {
     _head = _tail;
   }
+  // Signalled by the interrupt handler for each byte received
+  Event* event;
 }; 
 
 struct Tx_buffer: public Buffer<TX_BUFFER_SIZE> {
@@ -127,9 +157,26 @@ struct SerialBase : public Task {
   int writeable_data() const {
     return _tx_buffer->size - _tx_buffer->len() - 1;
   }
+  int peek_span_data(const byte** data) {
+    return _rx_buffer->span(data);
+  }
+  void consume_data(int size) {
+    _rx_buffer->consume(size);
+  }
+  int reserve_data(byte** data) {
+    return _tx_buffer->room(data);
+  }
+  void commit_data(int size) {
+    _tx_buffer->commit(size);
+  }
 
   // Serial specific
   void flush();
+  // Have the event signalled whenever data is received, so a task 
+  // can wait for it rather than poll
+  void set_rx_event(Event* event) {
+    _rx_buffer->event = event;
+  }
 protected:
   virtual boolean run();
   void init(Rx_buffer* rx_buffer, Tx_buffer* tx_buffer, // Buffers
@@ -176,6 +223,12 @@ struct Serial_template: public SerialBase, public ST {
   virtual int read(byte* data, int size) {
     return read_data(data, size);
   }
+  virtual int peek_span(const byte** data) {
+    return peek_span_data(data);
+  }
+  virtual void consume(int size) {
+    consume_data(size);
+  }
 
   // OStream interface
   virtual int writeable() const {
@@ -185,6 +238,12 @@ struct Serial_template: public SerialBase, public ST {
   virtual boolean write(const byte* data, int size) {
     return write_data(data, size);
   }
+  virtual int reserve(byte** data) {
+    return reserve_data(data);
+  }
+  virtual void commit(int size) {
+    commit_data(size);
+  }
 };
 
 typedef Serial_template<Stream> Serial;
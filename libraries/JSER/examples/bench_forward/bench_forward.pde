@@ -0,0 +1,71 @@
+#define DEBUG
+#include <JOS.h>
+#include <JSer.h>
+
+// Forwards serial data from port 2 to port 3, one byte at a time as
+// operator<< used to and a span at a time as it does now, and reports
+// the time forwarding takes per byte for each. Needs a Mega with TX1
+// wired to RX2, so port 1 can feed port 2.
+
+static const unsigned long duration = 2000000;
+
+JOS::Serial* feed;
+JOS::Serial* input;
+JOS::Serial* output;
+
+void keep_feeding()
+{
+  static byte b = 0;
+  while (feed->writeable() > 0) {
+    feed->write(&b, 1);
+    ++b;
+  }
+}
+
+void bench(boolean spans)
+{
+  unsigned long forwarding = 0;
+  unsigned long forwarded = 0;
+  unsigned long start = micros();
+  while (micros() - start < duration) {
+    // The serial tasks move the data out
+    JOS::tasks.run();
+    keep_feeding();
+    unsigned long begin = micros();
+    if (spans) {
+      forwarded += JOS::copy(*output, *input);
+    }
+    else {
+      byte b;
+      while (output->writeable() > 0 && input->read(&b, 1)) {
+        output->write(&b, 1);
+        ++forwarded;
+      }
+    }
+    forwarding += micros() - begin;
+  }
+  D_JOS(spans ? "Spans" : "Bytes");
+  D_JOS("Bytes forwarded:");
+  D_JOS(forwarded);
+  D_JOS("Nanoseconds per byte:");
+  D_JOS(forwarding * 1000 / forwarded);
+}
+
+void setup()
+{
+  D_JOS("");
+  D_JOS("Starting forwarding benchmark");
+  feed = new JOS::Serial(115200, 1);
+  input = new JOS::Serial(115200, 2);
+  output = new JOS::Serial(115200, 3);
+  JOS::tasks.add(feed);
+  JOS::tasks.add(input);
+  JOS::tasks.add(output);
+  bench(false);
+  bench(true);
+  D_JOS("Done");
+}
+
+void loop()
+{
+}
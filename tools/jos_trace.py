@@ -0,0 +1,126 @@
+#!/usr/bin/env python
+#
+#  jos_trace.py - Convert a JOS task trace dump to a timeline
+#  Copyright (c) 2010 Jaap Versteegh.  All right reserved.
+#
+#  This library is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU Lesser General Public
+#  License as published by the Free Software Foundation; either
+#  version 2.1 of the License, or (at your option) any later version.
+#
+#  This library is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#  Lesser General Public License for more details.
+#
+#  You should have received a copy of the GNU Lesser General Public
+#  License along with this library; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+"""
+Converts the binary trace dump written by TaskList::dump_trace into
+Chrome trace JSON, which chrome://tracing and Perfetto show as a
+timeline with a row per task. Text that was written to the same serial
+port in between is skipped.
+
+Capture the dump from the serial port with e.g.
+
+  stty -F /dev/ttyUSB0 9600 raw && cat /dev/ttyUSB0 > dump.bin
+
+and convert it with
+
+  jos_trace.py dump.bin trace.json [-n 0x01f2=Multiplexer ...]
+"""
+
+import json
+import struct
+import sys
+from optparse import OptionParser
+
+HEADER = 0xFE
+RECORD = 0xFF
+CHUNK_SIZE = 10
+REASONS = ["ready", "added", "rested", "event"]
+
+
+def parse(data):
+    """Return the records of all dumps in the data, as (task, start,
+    length, reason, tick length in microseconds) tuples"""
+    tick_micros = 4.0
+    records = []
+    i = 0
+    while i + CHUNK_SIZE <= len(data):
+        marker = ord(data[i:i + 1])
+        if marker == HEADER and data[i + 1:i + 5] == b"JTRC":
+            version, tick_nanosecs, count = struct.unpack(
+                "<BHH", data[i + 5:i + CHUNK_SIZE])
+            if version != 1:
+                raise ValueError("Unknown trace version %d" % version)
+            tick_micros = tick_nanosecs / 1000.0
+            i += CHUNK_SIZE
+        elif marker == RECORD:
+            task, start, length, reason = struct.unpack(
+                "<HLHB", data[i + 1:i + CHUNK_SIZE])
+            records.append((task, start, length, reason, tick_micros))
+            i += CHUNK_SIZE
+        else:
+            # Text in between the chunks
+            i += 1
+    return records
+
+
+def timeline(records, names):
+    """Chrome trace events for the records"""
+    events = []
+    offset = 0
+    previous = None
+    for task, start, length, reason, tick_micros in records:
+        # Ticks are 32 bits: unwrap them
+        if previous is not None and start + offset < previous - 0x80000000:
+            offset += 0x100000000
+        if previous is None:
+            # Start the timeline at the first record
+            offset = -start
+        previous = start + offset
+        name = names.get(task, "0x%04x" % task)
+        events.append({
+            "name": name,
+            "cat": "task",
+            "ph": "X",
+            "ts": (start + offset) * tick_micros,
+            "dur": length * tick_micros,
+            "pid": 0,
+            "tid": task,
+            "args": {
+                "reason": REASONS[reason] if reason < len(REASONS) else reason,
+            },
+        })
+    for task, name in names.items():
+        events.append({"name": "thread_name", "ph": "M", "pid": 0,
+            "tid": task, "args": {"name": name}})
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = OptionParser(usage="%prog dump [output] [-n address=name ...]")
+    parser.add_option("-n", "--name", action="append", default=[],
+        help="name of the task at an address, e.g. 0x01f2=Multiplexer")
+    options, args = parser.parse_args()
+    if len(args) < 1 or len(args) > 2:
+        parser.error("expected a dump file and optionally an output file")
+    names = {}
+    for name in options.name:
+        address, _, task_name = name.partition("=")
+        names[int(address, 0)] = task_name
+    with open(args[0], "rb") as dump:
+        records = parse(dump.read())
+    result = json.dumps(timeline(records, names), indent=1)
+    if len(args) > 1:
+        with open(args[1], "w") as output:
+            output.write(result)
+    else:
+        sys.stdout.write(result)
+
+
+if __name__ == "__main__":
+    main()